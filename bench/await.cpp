@@ -0,0 +1,58 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/future.hpp>
+
+
+namespace {
+
+
+    template<f5::makham::resumption M>
+    using async =
+            f5::makham::async<long, f5::makham::promise_type<long, M>>;
+
+
+    template<f5::makham::resumption M>
+    async<M> leaf() {
+        co_return 1;
+    }
+
+    template<f5::makham::resumption M>
+    async<M> chain(std::size_t n) {
+        long total{};
+        for (std::size_t i{}; i < n; ++i) { total += co_await leaf<M>(); }
+        co_return total;
+    }
+
+
+    /// A million sequential awaits of an async from a single coroutine.
+    /// Every leaf is posted to start, so `transfer` saves one of the two
+    /// jobs each await costs with `post`, not both.
+    template<f5::makham::resumption M>
+    void await_chain(std::string const &name) {
+        constexpr std::size_t n = 1'000'000;
+        auto const start = f5::makham::bench::clock::now();
+        f5::makham::future<long>::wrap(chain<M>(n)).get();
+        f5::makham::bench::report(
+                name, n, f5::makham::bench::clock::now() - start);
+    }
+    f5::makham::bench::scenario const c_await_chain_transfer{
+            "await-chain-transfer", []() {
+                await_chain<f5::makham::resumption::transfer>(
+                        "await-chain-transfer");
+            }};
+    f5::makham::bench::scenario const c_await_chain_post{
+            "await-chain-post", []() {
+                await_chain<f5::makham::resumption::post>("await-chain-post");
+            }};
+
+
+}
@@ -0,0 +1,70 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+namespace f5::makham::bench {
+
+
+    using clock = std::chrono::steady_clock;
+
+
+    /// ## Latency samples
+    /**
+     * Collects one duration per operation and reports percentiles over them.
+     * The throughput reported with them is over the time since the samples
+     * were created.
+     */
+    class latencies {
+        std::vector<clock::duration> samples;
+
+      public:
+        explicit latencies(std::size_t n) : samples(n) {}
+
+        clock::time_point const started = clock::now();
+
+        clock::duration &operator[](std::size_t i) { return samples[i]; }
+        std::size_t size() const { return samples.size(); }
+
+        /// Percentile in nanoseconds. `p` is in the range [0, 1].
+        double percentile(double p) {
+            if (samples.empty()) return 0;
+            auto const pos = static_cast<std::size_t>(p * (samples.size() - 1));
+            std::nth_element(
+                    samples.begin(), samples.begin() + pos, samples.end());
+            return std::chrono::duration<double, std::nano>(samples[pos])
+                    .count();
+        }
+    };
+
+
+    /// ## Scenario registration
+    /**
+     * Every scenario is run once for each of the thread counts being
+     * measured. Each run uses a new executor with that many threads, which
+     * is the current executor of the thread running the scenario.
+     */
+    struct scenario {
+        scenario(std::string name, std::function<void()> run);
+    };
+
+    /// Print a single JSON result line for the named scenario
+    void report(std::string const &name, latencies &l);
+    void report(
+            std::string const &name, std::size_t ops, clock::duration taken);
+
+
+}
@@ -0,0 +1,116 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/io.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/when.hpp>
+
+#include <netinet/in.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <system_error>
+
+
+namespace {
+
+
+    constexpr std::size_t wanted_connections = 10'000;
+    constexpr std::size_t requests = 10;
+    constexpr std::size_t message_size = 64;
+
+
+    /// Each connection needs a descriptor at both ends, so raise the limit
+    /// as far as it goes and use fewer connections if that isn't enough
+    std::size_t connection_count() {
+        ::rlimit limit{};
+        ::getrlimit(RLIMIT_NOFILE, &limit);
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+        ::getrlimit(RLIMIT_NOFILE, &limit);
+        return std::min<std::size_t>(
+                wanted_connections, (limit.rlim_cur - 64) / 2);
+    }
+
+
+    f5::makham::async<void> echo(f5::makham::socket s) {
+        char buffer[message_size];
+        try {
+            while (auto const n = co_await s.read(buffer, sizeof(buffer))) {
+                co_await s.write(buffer, n);
+            }
+        } catch (std::system_error const &) {
+            /// The clients reset their connections once they are done
+        }
+    }
+    f5::makham::async<void>
+            serve(f5::makham::socket &listener, std::size_t connections) {
+        std::vector<f5::makham::async<void>> echoes;
+        echoes.reserve(connections);
+        for (std::size_t i{}; i < connections; ++i) {
+            echoes.push_back(echo(co_await listener.accept()));
+        }
+        co_await f5::makham::when_all(std::move(echoes));
+    }
+
+
+    f5::makham::async<void> client(
+            sockaddr_in const &server,
+            f5::makham::bench::latencies &l,
+            std::size_t index) {
+        auto s = co_await f5::makham::connect(
+                reinterpret_cast<sockaddr const *>(&server), sizeof(server));
+        char message[message_size] = {}, reply[message_size];
+        for (std::size_t r{}; r < requests; ++r) {
+            auto const start = f5::makham::bench::clock::now();
+            co_await s.write(message, sizeof(message));
+            std::size_t got{};
+            while (got < sizeof(reply)) {
+                got += co_await s.read(reply + got, sizeof(reply) - got);
+            }
+            l[index * requests + r] = f5::makham::bench::clock::now() - start;
+        }
+        /// Reset rather than close so that runs at many thread counts
+        /// don't use up the ephemeral ports with connections in TIME_WAIT
+        ::linger const reset{1, 0};
+        ::setsockopt(
+                s.native_handle(), SOL_SOCKET, SO_LINGER, &reset,
+                sizeof(reset));
+    }
+
+
+    /// Loopback TCP echo of 64 byte requests over up to 10,000
+    /// connections at once. The latencies are of each request and reply
+    void echo_round_trips() {
+        auto const connections = connection_count();
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        auto listener = f5::makham::listen(
+                reinterpret_cast<sockaddr const *>(&address),
+                sizeof(address));
+        address.sin_port = htons(listener.local_port());
+        auto server = serve(listener, connections);
+
+        f5::makham::bench::latencies l{connections * requests};
+        std::vector<f5::makham::async<void>> clients;
+        clients.reserve(connections);
+        for (std::size_t i{}; i < connections; ++i) {
+            clients.push_back(client(address, l, i));
+        }
+        f5::makham::sync_wait(f5::makham::when_all(std::move(clients)));
+        f5::makham::sync_wait(std::move(server));
+        f5::makham::bench::report("echo", l);
+    }
+    f5::makham::bench::scenario const c_echo{"echo", echo_round_trips};
+
+
+}
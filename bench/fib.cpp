@@ -0,0 +1,59 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/task.hpp>
+#include <f5/makham/when.hpp>
+
+
+namespace {
+
+
+    constexpr long depth = 22;
+
+    /// Number of coroutines it takes to calculate `fib(n)`
+    std::size_t calls(long n) {
+        return n < 2 ? 1 : 1 + calls(n - 1) + calls(n - 2);
+    }
+
+
+    /// Every call but the leaves is posted to the executor
+    f5::makham::async<long> fib_async(long n) {
+        if (n < 2) { co_return n; }
+        auto a = fib_async(n - 1);
+        auto b = fib_async(n - 2);
+        co_return co_await a + co_await b;
+    }
+
+    /// Both halves are started together with a single bulk post
+    f5::makham::task<long> fib_task(long n) {
+        if (n < 2) { co_return n; }
+        auto [a, b] =
+                co_await f5::makham::when_all(fib_task(n - 1), fib_task(n - 2));
+        co_return a + b;
+    }
+
+
+    /// Recursive fan out, reported per coroutine.
+    template<typename F>
+    void fib(std::string const &name, F f) {
+        auto const start = f5::makham::bench::clock::now();
+        f5::makham::sync_wait(f(depth));
+        f5::makham::bench::report(
+                name, calls(depth), f5::makham::bench::clock::now() - start);
+    }
+    f5::makham::bench::scenario const c_fib_async{
+            "fib-async", []() { fib("fib-async", fib_async); }};
+    f5::makham::bench::scenario const c_fib_task{
+            "fib-task", []() { fib("fib-task", fib_task); }};
+
+
+}
@@ -0,0 +1,85 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/file.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/when.hpp>
+
+#include <string>
+
+#include <unistd.h>
+
+
+namespace {
+
+
+    constexpr std::size_t readers = 1'000;
+    constexpr std::size_t reads = 100;
+    constexpr std::size_t read_size = 64;
+    constexpr std::size_t file_size = 4 << 20;
+
+
+    f5::makham::async<void> reader(
+            f5::makham::file &f,
+            f5::makham::bench::latencies &l,
+            std::size_t index) {
+        char buffer[read_size];
+        for (std::size_t r{}; r < reads; ++r) {
+            auto const i = index * reads + r;
+            auto const offset = (i * 7919 * read_size) % file_size;
+            auto const start = f5::makham::bench::clock::now();
+            co_await f.read(buffer, sizeof(buffer), offset);
+            l[i] = f5::makham::bench::clock::now() - start;
+        }
+    }
+
+
+    /// 100,000 reads of 64 bytes spread over a 4MB file that is in the page
+    /// cache, by 1,000 coroutines at once. The latencies are of each read
+    void small_reads(std::string const &name, f5::makham::executor &e) {
+        std::string path = "/tmp/makham-bench-XXXXXX";
+        ::close(::mkstemp(path.data()));
+        f5::makham::file f{::open(path.c_str(), O_RDWR | O_CLOEXEC), e};
+        ::unlink(path.c_str());
+        std::string const contents(file_size, 'x');
+        f5::makham::sync_wait(f.write(contents.data(), contents.size(), 0));
+
+        f5::makham::bench::latencies l{readers * reads};
+        std::vector<f5::makham::async<void>> running;
+        running.reserve(readers);
+        for (std::size_t i{}; i < readers; ++i) {
+            running.push_back(reader(f, l, i));
+        }
+        f5::makham::sync_wait(f5::makham::when_all(std::move(running)));
+        f5::makham::bench::report(name, l);
+    }
+
+
+    void ring_reads() {
+        small_reads("file-reads", f5::makham::current_executor());
+    }
+    f5::makham::bench::scenario const c_file_reads{"file-reads", ring_reads};
+
+
+    /// The same on an executor that runs them on its blocking threads
+    void blocking_reads() {
+        f5::makham::executor::options o;
+        o.threads = f5::makham::current_executor().metrics().size();
+        o.name = "blocking";
+        o.io_uring = false;
+        f5::makham::executor e{o};
+        small_reads("file-reads-blocking", e);
+    }
+    f5::makham::bench::scenario const c_file_reads_blocking{
+            "file-reads-blocking", blocking_reads};
+
+
+}
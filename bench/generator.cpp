@@ -0,0 +1,58 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/generator.hpp>
+
+
+namespace {
+
+
+    constexpr long count = 10'000'000;
+
+    /// Stops the compiler from working the totals out ahead of time
+    volatile long g_limit = count;
+    volatile long g_sink;
+
+
+    f5::makham::generator<long> numbers(long limit) {
+        for (long i{}; i < limit; ++i) { co_yield i; }
+    }
+
+
+    /// Iterating a generator, which runs on the calling thread only.
+    void generator() {
+        auto const start = f5::makham::bench::clock::now();
+        long total{};
+        for (auto v : numbers(g_limit)) {
+            total += v;
+            g_sink = total;
+        }
+        f5::makham::bench::report(
+                "generator", count, f5::makham::bench::clock::now() - start);
+    }
+    f5::makham::bench::scenario const c_generator{"generator", generator};
+
+
+    /// The same sum with a plain loop, as a baseline.
+    void loop() {
+        auto const start = f5::makham::bench::clock::now();
+        long total{};
+        for (long i{}, limit = g_limit; i < limit; ++i) {
+            total += i;
+            g_sink = total;
+        }
+        f5::makham::bench::report(
+                "generator-loop", count,
+                f5::makham::bench::clock::now() - start);
+    }
+    f5::makham::bench::scenario const c_loop{"generator-loop", loop};
+
+
+}
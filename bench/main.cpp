@@ -0,0 +1,138 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/executor.hpp>
+#include <f5/makham/frame_pool.hpp>
+
+#include <iostream>
+#include <set>
+#include <thread>
+#include <utility>
+
+
+namespace {
+    auto &scenarios() {
+        static std::vector<std::pair<std::string, std::function<void()>>> s;
+        return s;
+    }
+
+    /// Thread count of the executor the scenarios are running on
+    std::size_t g_threads = {};
+
+    /// Powers of two up to the hardware thread count, and that count
+    std::set<std::size_t> default_threads() {
+        std::size_t const hardware =
+                std::max(1u, std::thread::hardware_concurrency());
+        std::set<std::size_t> counts{hardware};
+        for (std::size_t n = 1; n < hardware; n *= 2) { counts.insert(n); }
+        return counts;
+    }
+
+    /// Parse a comma separated list of thread counts
+    std::set<std::size_t> parse_threads(std::string const &list) {
+        std::set<std::size_t> counts;
+        std::size_t pos{};
+        while (pos < list.size()) {
+            auto const comma = std::min(list.find(',', pos), list.size());
+            if (auto const n = std::stoul(list.substr(pos, comma - pos)); n) {
+                counts.insert(n);
+            }
+            pos = comma + 1;
+        }
+        return counts;
+    }
+
+    /// Start of every result line
+    std::ostream &line(std::string const &name) {
+        return std::cout << "{\"scenario\":\"" << name
+                         << "\",\"threads\":" << g_threads;
+    }
+
+    void report_metrics(f5::makham::executor const &e) {
+        f5::makham::worker_metrics total;
+        for (auto const &m : e.metrics()) {
+            total.executed += m.executed;
+            total.steal_attempts += m.steal_attempts;
+            total.steals += m.steals;
+            total.parks += m.parks;
+            total.idle += m.idle;
+            total.overflowed += m.overflowed;
+        }
+        line("executor") << ",\"executed\":" << total.executed
+                         << ",\"steals\":" << total.steals
+                         << ",\"steal_attempts\":" << total.steal_attempts
+                         << ",\"parks\":" << total.parks << ",\"idle_ms\":"
+                         << std::chrono::duration_cast<
+                                    std::chrono::milliseconds>(total.idle)
+                                    .count()
+                         << ",\"overflow\":" << total.overflowed << "}"
+                         << std::endl;
+    }
+}
+
+
+f5::makham::bench::scenario::scenario(
+        std::string name, std::function<void()> run) {
+    scenarios().emplace_back(std::move(name), std::move(run));
+}
+
+
+void f5::makham::bench::report(std::string const &name, latencies &l) {
+    auto const s = std::chrono::duration<double>(clock::now() - l.started)
+                           .count();
+    line(name) << ",\"n\":" << l.size() << ",\"ops_per_s\":" << l.size() / s
+               << ",\"p50_ns\":" << l.percentile(0.5)
+               << ",\"p90_ns\":" << l.percentile(0.9)
+               << ",\"p99_ns\":" << l.percentile(0.99)
+               << ",\"p999_ns\":" << l.percentile(0.999)
+               << ",\"max_ns\":" << l.percentile(1) << "}" << std::endl;
+}
+
+
+void f5::makham::bench::report(
+        std::string const &name, std::size_t ops, clock::duration taken) {
+    auto const ns = std::chrono::duration<double, std::nano>(taken).count();
+    line(name) << ",\"n\":" << ops << ",\"ns_per_op\":" << ns / ops
+               << ",\"ops_per_s\":" << ops * 1e9 / ns << "}" << std::endl;
+}
+
+
+/**
+ * Usage: `makham-bench [--threads=1,2,4] [scenario...]`
+ *
+ * Runs the named scenarios, or all of them, at each thread count. Every
+ * result is printed as a single line JSON object.
+ */
+int main(int argc, char const *argv[]) {
+    auto counts = default_threads();
+    std::set<std::string> wanted;
+    for (int a = 1; a < argc; ++a) {
+        std::string const arg = argv[a];
+        if (arg.rfind("--threads=", 0) == 0) {
+            counts = parse_threads(arg.substr(10));
+        } else {
+            wanted.insert(arg);
+        }
+    }
+    for (auto const threads : counts) {
+        g_threads = threads;
+        f5::makham::executor e{{threads, 1024, "bench"}};
+        f5::makham::use_executor const use{e};
+        for (auto &s : scenarios()) {
+            if (wanted.empty() || wanted.count(s.first)) { s.second(); }
+        }
+        report_metrics(e);
+    }
+    auto const frames = f5::makham::frame_pool::stats();
+    std::cout << "{\"scenario\":\"frame-pool\",\"hits\":" << frames.hits
+              << ",\"misses\":" << frames.misses
+              << ",\"bytes\":" << frames.bytes << "}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,96 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/multi.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/when.hpp>
+
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+
+    constexpr std::size_t clients = 256;
+    constexpr std::size_t rounds = 2'000;
+
+    template<typename V>
+    using memoized = f5::makham::multi<f5::makham::async<V>>;
+
+
+    /// Holds the producer back until all of the clients are waiting
+    struct gate {
+        std::atomic<bool> armed = false;
+        f5::makham::coroutine_handle<> producer = {};
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(f5::makham::coroutine_handle<> h) noexcept {
+            producer = h;
+            armed = true;
+        }
+        void await_resume() const noexcept {}
+
+        void open() {
+            while (not armed) std::this_thread::yield();
+            f5::makham::post(producer);
+        }
+    };
+
+    long size(long v) { return v; }
+    long size(std::vector<long> const &v) { return v.size(); }
+
+    template<typename V>
+    f5::makham::async<V> produce(gate &g, V v) {
+        co_await g;
+        co_return v;
+    }
+
+    std::atomic<std::size_t> started;
+    template<typename V>
+    f5::makham::async<long> client(memoized<V> m) {
+        ++started;
+        auto const &v = co_await m;
+        co_return size(v);
+    }
+
+
+    /// 256 coroutines all waiting for the same memoized value.
+    template<typename V>
+    void fan_out(std::string const &name, V value) {
+        auto const start = f5::makham::bench::clock::now();
+        for (std::size_t r{}; r < rounds; ++r) {
+            gate g;
+            memoized<V> m{produce(g, value)};
+            started = 0;
+            std::vector<f5::makham::async<long>> waiting;
+            waiting.reserve(clients);
+            for (std::size_t c{}; c < clients; ++c) {
+                waiting.push_back(client<V>(m));
+            }
+            while (started < clients) std::this_thread::yield();
+            g.open();
+            f5::makham::sync_wait(f5::makham::when_all(std::move(waiting)));
+        }
+        f5::makham::bench::report(
+                name, rounds * clients,
+                f5::makham::bench::clock::now() - start);
+    }
+    f5::makham::bench::scenario const c_fan_out{
+            "multi-fan-out", []() { fan_out("multi-fan-out", 42l); }};
+    /// The same with a 32KB memoized value
+    f5::makham::bench::scenario const c_fan_out_large{
+            "multi-fan-out-large", []() {
+                fan_out("multi-fan-out-large", std::vector<long>(4096));
+            }};
+
+
+}
@@ -0,0 +1,163 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/executor.hpp>
+
+#include <atomic>
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+
+namespace {
+
+
+    /// Time from `post` until the job starts running. A short pause between
+    /// jobs lets the workers go idle so this measures wake up latency.
+    void post_latency() {
+        f5::makham::bench::latencies l{10'000};
+        std::atomic<bool> done;
+        for (std::size_t i{}; i < l.size(); ++i) {
+            done = false;
+            auto const posted = f5::makham::bench::clock::now();
+            f5::makham::post([&, i, posted]() {
+                l[i] = f5::makham::bench::clock::now() - posted;
+                done = true;
+            });
+            while (not done) std::this_thread::yield();
+            std::this_thread::sleep_for(100us);
+        }
+        f5::makham::bench::report("post-latency", l);
+    }
+    f5::makham::bench::scenario const c_post_latency{
+            "post-latency", post_latency};
+
+
+    /// Time from `post` until the job starts running when a burst of jobs
+    /// is posted at once.
+    void post_burst_latency() {
+        constexpr std::size_t burst = 512;
+        f5::makham::bench::latencies l{burst * 50};
+        std::atomic<std::size_t> done;
+        for (std::size_t b{}; b < l.size(); b += burst) {
+            done = 0;
+            for (std::size_t i{b}; i < b + burst; ++i) {
+                auto const posted = f5::makham::bench::clock::now();
+                f5::makham::post([&, i, posted]() {
+                    l[i] = f5::makham::bench::clock::now() - posted;
+                    ++done;
+                });
+            }
+            while (done < burst) std::this_thread::yield();
+            std::this_thread::sleep_for(1ms);
+        }
+        f5::makham::bench::report("post-burst-latency", l);
+    }
+    f5::makham::bench::scenario const c_post_burst_latency{
+            "post-burst-latency", post_burst_latency};
+
+
+    /// Throughput of jobs posted from inside the executor. Each worker has
+    /// a few chains of jobs on the go, each of which posts the next.
+    struct chain {
+        std::atomic<long> &remaining;
+        std::atomic<std::size_t> &done;
+
+        void operator()() const {
+            if (remaining.fetch_sub(1) > 0) {
+                f5::makham::post(chain{remaining, done});
+            } else {
+                ++done;
+            }
+        }
+    };
+    void post_throughput() {
+        constexpr long jobs = 1'000'000;
+        auto const chains = 4 * f5::makham::current_executor().metrics().size();
+        std::atomic<long> remaining{jobs};
+        std::atomic<std::size_t> done{};
+        auto const started = f5::makham::bench::clock::now();
+        for (std::size_t c{}; c < chains; ++c) {
+            f5::makham::post(chain{remaining, done});
+        }
+        while (done < chains) std::this_thread::yield();
+        f5::makham::bench::report(
+                "post-throughput", jobs,
+                f5::makham::bench::clock::now() - started);
+    }
+    f5::makham::bench::scenario const c_post_throughput{
+            "post-throughput", post_throughput};
+
+
+    /// Throughput of a burst far larger than the queues, so that most of
+    /// the jobs go on to the overflow.
+    void post_overflow() {
+        constexpr std::size_t burst = 100'000;
+        std::atomic<std::size_t> done{};
+        auto const started = f5::makham::bench::clock::now();
+        for (std::size_t i{}; i < burst; ++i) {
+            f5::makham::post([&]() { ++done; });
+        }
+        while (done < burst) std::this_thread::yield();
+        f5::makham::bench::report(
+                "post-overflow", burst,
+                f5::makham::bench::clock::now() - started);
+    }
+    f5::makham::bench::scenario const c_post_overflow{
+            "post-overflow", post_overflow};
+
+
+    /// Time from `post` until the job starts running when it is posted
+    /// behind a backlog of batch jobs, at each priority.
+    void post_under_load(f5::makham::priority p, char const *name) {
+        constexpr std::size_t backlog = 256;
+        f5::makham::bench::latencies l{2'000};
+        std::atomic<std::size_t> batch;
+        std::atomic<bool> done;
+        for (std::size_t i{}; i < l.size(); ++i) {
+            batch = 0;
+            done = false;
+            for (std::size_t j{}; j < backlog; ++j) {
+                f5::makham::post(
+                        [&]() {
+                            auto const until = f5::makham::bench::clock::now()
+                                    + 1us;
+                            while (f5::makham::bench::clock::now() < until)
+                                ;
+                            ++batch;
+                        },
+                        f5::makham::priority::normal);
+            }
+            auto const posted = f5::makham::bench::clock::now();
+            f5::makham::post(
+                    [&, i, posted]() {
+                        l[i] = f5::makham::bench::clock::now() - posted;
+                        done = true;
+                    },
+                    p);
+            while (not done || batch < backlog) std::this_thread::yield();
+        }
+        f5::makham::bench::report(name, l);
+    }
+    f5::makham::bench::scenario const c_post_normal_under_load{
+            "post-normal-under-load", []() {
+                post_under_load(
+                        f5::makham::priority::normal,
+                        "post-normal-under-load");
+            }};
+    f5::makham::bench::scenario const c_post_high_under_load{
+            "post-high-under-load", []() {
+                post_under_load(
+                        f5::makham::priority::high, "post-high-under-load");
+            }};
+
+
+}
@@ -0,0 +1,58 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/future.hpp>
+#include <f5/makham/sync_wait.hpp>
+
+
+namespace {
+
+
+    constexpr std::size_t round_trips = 100'000;
+
+
+    f5::makham::async<int> answer() { co_return 42; }
+
+
+    /// Round trip from a thread outside the executor into a coroutine and
+    /// back again through `future::get`.
+    void future_get() {
+        f5::makham::bench::latencies l{round_trips};
+        for (std::size_t i{}; i < l.size(); ++i) {
+            auto const start = f5::makham::bench::clock::now();
+            f5::makham::future<int>::wrap(answer()).get();
+            l[i] = f5::makham::bench::clock::now() - start;
+        }
+        f5::makham::bench::report("future-get", l);
+    }
+    f5::makham::bench::scenario const c_future_get{"future-get", future_get};
+
+
+    /// The same round trip through `sync_wait`.
+    void round_trip(std::string const &name, f5::makham::waiting w) {
+        f5::makham::bench::latencies l{round_trips};
+        for (std::size_t i{}; i < l.size(); ++i) {
+            auto const start = f5::makham::bench::clock::now();
+            f5::makham::sync_wait(answer(), w);
+            l[i] = f5::makham::bench::clock::now() - start;
+        }
+        f5::makham::bench::report(name, l);
+    }
+    f5::makham::bench::scenario const c_sync_wait{"sync-wait", []() {
+        round_trip("sync-wait", f5::makham::waiting::block);
+    }};
+    f5::makham::bench::scenario const c_sync_wait_help{
+            "sync-wait-help", []() {
+                round_trip("sync-wait-help", f5::makham::waiting::help);
+            }};
+
+
+}
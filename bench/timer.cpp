@@ -0,0 +1,52 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/when.hpp>
+
+
+namespace {
+
+
+    constexpr std::size_t sleepers = 100'000;
+
+
+    f5::makham::async<void> sleeper(
+            f5::makham::bench::latencies &l,
+            f5::makham::timer_clock::time_point start,
+            std::size_t i) {
+        auto const until =
+                start + std::chrono::microseconds((i * 7919) % 1'000'000);
+        co_await f5::makham::sleep_until(until);
+        l[i] = f5::makham::timer_clock::now() - until;
+    }
+
+
+    /// How late 100,000 sleeps spread over a second wake up. The first is
+    /// due after all of them should have gone to sleep.
+    void timer_lateness() {
+        f5::makham::bench::latencies l{sleepers};
+        auto const start = f5::makham::timer_clock::now()
+                + std::chrono::milliseconds(500);
+        std::vector<f5::makham::async<void>> waiting;
+        waiting.reserve(sleepers);
+        for (std::size_t i{}; i < sleepers; ++i) {
+            waiting.push_back(sleeper(l, start, i));
+        }
+        f5::makham::sync_wait(f5::makham::when_all(std::move(waiting)));
+        f5::makham::bench::report("timer-lateness", l);
+    }
+    f5::makham::bench::scenario const c_timer_lateness{
+            "timer-lateness", timer_lateness};
+
+
+}
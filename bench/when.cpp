@@ -0,0 +1,97 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "bench.hpp"
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/future.hpp>
+#include <f5/makham/task.hpp>
+#include <f5/makham/when.hpp>
+
+
+namespace {
+
+
+    constexpr std::size_t fan_out = 64;
+    constexpr std::size_t rounds = 10'000;
+
+
+    f5::makham::async<long> leaf() { co_return 1; }
+
+    f5::makham::async<long> gather_sequential() {
+        long total{};
+        for (std::size_t r{}; r < rounds; ++r) {
+            std::vector<f5::makham::async<long>> asyncs;
+            asyncs.reserve(fan_out);
+            for (std::size_t i{}; i < fan_out; ++i) {
+                asyncs.push_back(leaf());
+            }
+            for (auto &a : asyncs) { total += co_await a; }
+        }
+        co_return total;
+    }
+
+    f5::makham::async<long> gather_when_all() {
+        long total{};
+        for (std::size_t r{}; r < rounds; ++r) {
+            std::vector<f5::makham::async<long>> asyncs;
+            asyncs.reserve(fan_out);
+            for (std::size_t i{}; i < fan_out; ++i) {
+                asyncs.push_back(leaf());
+            }
+            for (auto v : co_await f5::makham::when_all(std::move(asyncs))) {
+                total += v;
+            }
+        }
+        co_return total;
+    }
+
+    f5::makham::task<long> lazy_leaf() { co_return 1; }
+
+    /// The tasks are started with one bulk post per round
+    f5::makham::async<long> gather_when_all_tasks() {
+        long total{};
+        for (std::size_t r{}; r < rounds; ++r) {
+            std::vector<f5::makham::task<long>> tasks;
+            tasks.reserve(fan_out);
+            for (std::size_t i{}; i < fan_out; ++i) {
+                tasks.push_back(lazy_leaf());
+            }
+            for (auto v : co_await f5::makham::when_all(std::move(tasks))) {
+                total += v;
+            }
+        }
+        co_return total;
+    }
+
+
+    /// Scatter 64 coroutines and gather their results, 10,000 times over.
+    void scatter_gather(
+            std::string const &name, f5::makham::async<long> (*gather)()) {
+        auto const start = f5::makham::bench::clock::now();
+        f5::makham::future<long>::wrap(gather()).get();
+        f5::makham::bench::report(
+                name, rounds * fan_out,
+                f5::makham::bench::clock::now() - start);
+    }
+    f5::makham::bench::scenario const c_gather_sequential{
+            "gather-sequential", []() {
+                scatter_gather("gather-sequential", gather_sequential);
+            }};
+    f5::makham::bench::scenario const c_gather_when_all{
+            "gather-when-all", []() {
+                scatter_gather("gather-when-all", gather_when_all);
+            }};
+    f5::makham::bench::scenario const c_gather_when_all_tasks{
+            "gather-when-all-tasks", []() {
+                scatter_gather(
+                        "gather-when-all-tasks", gather_when_all_tasks);
+            }};
+
+
+}
@@ -10,16 +10,16 @@
 
 
 #include <f5/makham/executor.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/stop.hpp>
+#include <f5/makham/trace.hpp>
 
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <thread>
 #include <variant>
 
-#ifdef MAKHAM_STDOUT_TRACE
-#include <iostream>
-#endif
-
 
 namespace f5 {
     namespace detail {
@@ -42,8 +42,20 @@ namespace f5 {
 namespace f5::makham {
 
 
+    /// ## Resumption
+    /**
+     * How a completed async resumes the coroutine awaiting it. With
+     * `transfer` the awaiting coroutine is resumed directly from the
+     * async's final suspend point using symmetric transfer, which saves
+     * the job that would otherwise carry the result back. With `post` it
+     * is scheduled as a new job on the executor instead. Either way an
+     * async is eager, so starting it is still posted to the executor.
+     */
+    enum class resumption { transfer, post };
+
+
     /// Forward declarations
-    template<typename R>
+    template<typename R, resumption = resumption::transfer>
     struct promise_type;
     template<typename R, typename P = promise_type<R>>
     class async;
@@ -52,10 +64,28 @@ namespace f5::makham {
     /// ## Async
     /**
      * A async whose completion can be awaited..
+     *
+     * Asyncs are stoppable. A stop can be requested directly, and one
+     * requested on an awaiting async is passed on to the async it awaits.
+     * Work inside the coroutine checks for it with `this_stop_token` or
+     * `until_stopped`. Destroying an async that hasn't completed requests
+     * a stop and leaves the coroutine to destroy itself once it finishes.
+     *
+     * The link from the awaiting coroutine only exists while it awaits.
+     * A child started earlier, and not awaited yet, only sees a stop
+     * requested on its parent in the meantime once the parent gets round
+     * to awaiting it, or drops it. Work that must stop straight away can
+     * be handed the parent's token instead:
+     *
+     * ```cpp
+     * auto child = work(co_await f5::makham::this_stop_token());
+     * ```
      */
     template<typename R, typename P>
     class async final {
         bool awaited = false;
+        /// Passes stops from the awaiting coroutine on to this one
+        detail::stop_link parent;
 
       public:
         using promise_type = P;
@@ -65,57 +95,36 @@ namespace f5::makham {
         async(async const &) = delete;
         async &operator=(async const &) = delete;
         /// Movable
-        async(async &&t) noexcept : coro(std::exchange(t.coro, {})) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Move construct async" << std::endl;
-#endif
-        }
+        async(async &&t) noexcept : coro(std::exchange(t.coro, {})) {}
         async &operator=(async &&t) noexcept {
-            if (coro) {
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout
-                        << "Moved assign async & found and old coro to destroy"
-                        << std::endl;
-#endif
-                coro.destroy();
-#ifdef MAKHAM_STDOUT_TRACE
-            } else {
-                std::cout << "Moved assign async" << std::endl;
-#endif
-            }
+            release();
             coro = std::exchange(t.coro, {});
+            return *this;
         }
-        ~async() {
-            // TODO If there has been no co_await we must wait before
-            // we destroy this thing...
-            if (coro) {
-#ifdef MAKHAM_STDOUT_TRACE
-                if (not awaited) {
-                    std::cout << "Async not awaited !!!!" << std::endl;
-                }
-                std::cout << "Async destructed, and taking the promise with it"
-                          << std::endl;
-#endif
-                coro.destroy();
-#ifdef MAKHAM_STDOUT_TRACE
-            } else {
-                std::cout << "Async destructed, but no coro" << std::endl;
-#endif
-            }
+        ~async() { release(); }
+
+        /// ### Stopping
+        bool request_stop() noexcept {
+            return coro && coro.promise().request_stop();
+        }
+        stop_token get_stop_token() noexcept {
+            return coro ? coro.promise().get_stop_token() : stop_token{};
         }
 
         /// ### Awaitable
-        bool await_ready() const { return false; }
-        void await_suspend(coroutine_handle<> awaiting) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async will signal another coroutine" << std::endl;
-#endif
-            coro.promise().signal(awaiting);
+        bool await_ready() const { return coro.promise().is_ready(); }
+        template<typename A>
+        bool await_suspend(coroutine_handle<A> awaiting) {
+            parent.attach(awaiting, coro.promise());
+            if (coro.promise().signal(awaiting)) {
+                return true;
+            } else {
+                parent.detach();
+                return false;
+            }
         }
         R await_resume() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async returning co_awaited value" << std::endl;
-#endif
+            parent.detach();
             awaited = true;
             return coro.promise().get_value();
         }
@@ -125,70 +134,104 @@ namespace f5::makham {
         handle_type coro;
 
         async(handle_type c) : coro{c} {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async starting" << std::endl;
-#endif
-            post(coro);
+            trace::record(trace::event::created, coro);
+        }
+
+        void release() noexcept {
+            parent.detach();
+            if (coro) {
+                if (not coro.promise().is_ready()) {
+                    coro.promise().request_stop();
+                }
+                if (coro.promise().abandon()) { trace::destroy(coro); }
+                coro = {};
+            }
         }
     };
 
 
     /// An asynchronous promise
-    struct async_promise {
-        std::atomic<bool> has_value = false;
-        std::atomic<coroutine_handle<>> continuation = {};
-
-        void continuation_if_not_run() {
-            if (auto h = continuation.exchange({}); h) {
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "Async continuation starting" << std::endl;
-#endif
-                post(h);
-#ifdef MAKHAM_STDOUT_TRACE
-            } else {
-                std::cout << "Async no continuation found to start yet"
-                          << std::endl;
-#endif
-            }
+    /**
+     * All of the promise's state is a single atomic word. It starts out
+     * `empty` and then either becomes `ready` when the coroutine completes,
+     * or holds the address of the coroutine awaiting it. Awaiting and
+     * completing are each a single atomic operation. It is `abandoned`
+     * once the async is destroyed, and then whichever of the async and the
+     * coroutine gets there last destroys the frame.
+     */
+    template<resumption Mode>
+    struct async_promise : public pooled_frame, public stoppable {
+        static constexpr std::uintptr_t empty = 0u, ready = 1u,
+                                        abandoned = 2u;
+        std::atomic<std::uintptr_t> state = empty;
+
+        bool is_ready() const noexcept {
+            return state.load(std::memory_order_acquire) == ready;
         }
-        void signal(coroutine_handle<> s) {
-            auto const old = continuation.exchange(s);
-            if (old) {
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "Async signal throwing" << std::endl;
-#endif
+
+        /// Record the awaiting coroutine. Returns `false` if the value
+        /// arrived in the meantime and the caller must not suspend.
+        bool signal(coroutine_handle<> s) {
+            auto expected = empty;
+            if (state.compare_exchange_strong(
+                        expected, reinterpret_cast<std::uintptr_t>(s.address()),
+                        std::memory_order_acq_rel,
+                        std::memory_order_acquire)) {
+                return true;
+            } else if (expected == ready) {
+                return false;
+            } else {
                 throw std::invalid_argument{
                         "An async can only have one awaitable"};
             }
-            if (has_value.exchange(false)) {
-                continuation_if_not_run();
-#ifdef MAKHAM_STDOUT_TRACE
-            } else {
-                std::cout << "Async value not available, continuation has been "
-                             "set"
-                          << std::endl;
-#endif
-            }
         }
-        void value_has_been_set() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async value now set" << std::endl;
-#endif
-            if (has_value.exchange(true)) {
-                throw std::runtime_error{"Coroutine already had a value set"};
-            }
-            continuation_if_not_run();
+        /// Called by the async when nobody can await the value any more.
+        /// Returns `true` if the coroutine has completed and the frame is
+        /// to be destroyed now, otherwise it destroys itself when done.
+        bool abandon() noexcept {
+            return state.exchange(abandoned, std::memory_order_acq_rel)
+                    == ready;
         }
-        auto initial_suspend() { return suspend_always{}; }
-        auto final_suspend() { return suspend_always{}; }
+        /// Called once the coroutine is suspended for the last time.
+        /// Returns what was there before, which is the continuation to be
+        /// resumed if there is one.
+        std::uintptr_t completed() {
+            return state.exchange(ready, std::memory_order_acq_rel);
+        }
+
+        struct final_awaiter {
+            bool await_ready() const noexcept { return false; }
+            template<typename P>
+            coroutine_handle<>
+                    await_suspend(coroutine_handle<P> h) const noexcept {
+                trace::record(trace::event::completed, h);
+                auto const old = h.promise().completed();
+                if (old == abandoned) {
+                    trace::destroy(h);
+                } else if (old != empty) {
+                    auto const c = coroutine_handle<>::from_address(
+                            reinterpret_cast<void *>(old));
+                    if constexpr (Mode == resumption::transfer) {
+                        return trace::transfer(h, c);
+                    } else {
+                        post(c);
+                    }
+                }
+                return noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        auto initial_suspend() { return schedule{}; }
+        auto final_suspend() noexcept { return final_awaiter{}; }
     };
 
 
     /// ## The async promise type
-    template<typename R>
-    struct promise_type final : public async_promise {
-        using async_type = async<R, promise_type<R>>;
-        using handle_type = coroutine_handle<promise_type<R>>;
+    template<typename R, resumption Mode>
+    struct promise_type final : public async_promise<Mode> {
+        using async_type = async<R, promise_type<R, Mode>>;
+        using handle_type = coroutine_handle<promise_type<R, Mode>>;
 
         std::variant<std::monostate, std::exception_ptr, R> value = {};
 
@@ -196,19 +239,11 @@ namespace f5::makham {
             return async_type{handle_type::from_promise(*this)};
         }
         auto return_value(R v) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async co_returned value" << std::endl;
-#endif
             value = std::move(v);
-            value_has_been_set();
             return suspend_never{};
         }
         void unhandled_exception() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async exception caught" << std::endl;
-#endif
             value = std::current_exception();
-            value_has_been_set();
         }
 
         R get_value() {
@@ -223,10 +258,10 @@ namespace f5::makham {
         }
     };
 
-    template<>
-    struct promise_type<void> final : public async_promise {
-        using async_type = async<void, promise_type<void>>;
-        using handle_type = coroutine_handle<promise_type<void>>;
+    template<resumption Mode>
+    struct promise_type<void, Mode> final : public async_promise<Mode> {
+        using async_type = async<void, promise_type<void, Mode>>;
+        using handle_type = coroutine_handle<promise_type<void, Mode>>;
 
         std::exception_ptr value;
 
@@ -234,18 +269,10 @@ namespace f5::makham {
             return async_type{handle_type::from_promise(*this)};
         }
         auto return_void() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async co_returned void" << std::endl;
-#endif
-            value_has_been_set();
             return suspend_never{};
         }
         void unhandled_exception() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Async exception caught" << std::endl;
-#endif
             value = std::current_exception();
-            value_has_been_set();
         }
 
         void get_value() {
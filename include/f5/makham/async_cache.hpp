@@ -0,0 +1,159 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/multi.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+namespace f5::makham {
+
+
+    /// ## Async cache
+    /**
+     * Memoizes asyncs by key. Looking up a key that isn't in the cache
+     * calls the loader to start an `async` for it and stores it as a
+     * `multi`, which every later lookup shares. So concurrent lookups of
+     * a key that is still loading all wait on the one load.
+     *
+     * The keys are spread over a number of shards, each with its own lock,
+     * LRU list and share of the capacity. An entry is loaded again once it
+     * is older than the time to live, if there is one, or if its load
+     * failed with an exception.
+     *
+     * The loader is called with the shard's lock held, so it must not use
+     * the cache itself.
+     */
+    template<
+            typename K,
+            typename V,
+            typename Hash = std::hash<K>,
+            typename Equal = std::equal_to<K>>
+    class async_cache final {
+      public:
+        using clock = std::chrono::steady_clock;
+        using value_type = multi<async<V>>;
+
+        /// Counters summed over all shards
+        struct statistics {
+            /// Lookups that found a loaded value
+            std::size_t hits = {};
+            /// Lookups that had to start a load
+            std::size_t misses = {};
+            /// Lookups that joined a load already in progress
+            std::size_t coalesced = {};
+            /// Entries dropped to stay within capacity
+            std::size_t evictions = {};
+        };
+
+        /// A `ttl` of zero means that entries never expire
+        explicit async_cache(
+                std::size_t capacity = 1024,
+                clock::duration ttl = {},
+                std::size_t shard_count = 16)
+        : ttl{ttl}, shards(shard_count ? shard_count : 1) {
+            for (auto &s : shards) {
+                s.capacity = std::max<std::size_t>(1, capacity / shards.size());
+            }
+        }
+
+        /// Return the memoized value for the key, calling `load(key)` to
+        /// get an `async<V>` for it if it isn't cached
+        template<typename L>
+        value_type get(K const &key, L &&load);
+
+        statistics stats();
+
+      private:
+        struct entry {
+            K key;
+            value_type value;
+            clock::time_point loaded;
+        };
+        using lru_type = std::list<entry>;
+
+        struct alignas(64) shard {
+            std::mutex mutex;
+            lru_type lru;
+            std::unordered_map<K, typename lru_type::iterator, Hash, Equal>
+                    index;
+            std::size_t capacity = {};
+            statistics counters;
+        };
+
+        clock::duration const ttl;
+        std::vector<shard> shards;
+
+        shard &shard_for(K const &key) {
+            return shards[Hash{}(key) % shards.size()];
+        }
+        bool expired(entry const &e, clock::time_point now) const {
+            return ttl != clock::duration{} && now - e.loaded > ttl;
+        }
+    };
+
+
+}
+
+
+template<typename K, typename V, typename Hash, typename Equal>
+template<typename L>
+inline auto f5::makham::async_cache<K, V, Hash, Equal>::get(
+        K const &key, L &&load) -> value_type {
+    auto &s = shard_for(key);
+    auto const now = clock::now();
+    std::lock_guard<std::mutex> lock{s.mutex};
+    if (auto found = s.index.find(key); found != s.index.end()) {
+        auto const e = found->second;
+        if (not e->value.is_ready()) {
+            ++s.counters.coalesced;
+            s.lru.splice(s.lru.begin(), s.lru, e);
+            return e->value;
+        } else if (not e->value.has_exception() && not expired(*e, now)) {
+            ++s.counters.hits;
+            s.lru.splice(s.lru.begin(), s.lru, e);
+            return e->value;
+        } else {
+            s.index.erase(found);
+            s.lru.erase(e);
+        }
+    }
+    ++s.counters.misses;
+    s.lru.push_front(entry{key, value_type{load(key)}, now});
+    s.index.emplace(key, s.lru.begin());
+    if (s.lru.size() > s.capacity) {
+        s.index.erase(s.lru.back().key);
+        s.lru.pop_back();
+        ++s.counters.evictions;
+    }
+    return s.lru.front().value;
+}
+
+
+template<typename K, typename V, typename Hash, typename Equal>
+inline auto f5::makham::async_cache<K, V, Hash, Equal>::stats() -> statistics {
+    statistics total;
+    for (auto &s : shards) {
+        std::lock_guard<std::mutex> lock{s.mutex};
+        total.hits += s.counters.hits;
+        total.misses += s.counters.misses;
+        total.coalesced += s.counters.coalesced;
+        total.evictions += s.counters.evictions;
+    }
+    return total;
+}
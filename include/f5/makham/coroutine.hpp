@@ -9,6 +9,10 @@
 #pragma once
 
 
+#include <type_traits>
+#include <utility>
+
+
 #if __has_include(<coroutine>)
 #include <coroutine>
 namespace f5::makham {
@@ -16,6 +20,7 @@ namespace f5::makham {
     using coroutine_handle = std::coroutine_handle<T>;
     using suspend_always = std::suspend_always;
     using suspend_never = std::suspend_never;
+    using std::noop_coroutine;
 }
 /**
 Super bad idea, but the sort of thing that would be needed to make
@@ -39,5 +44,50 @@ namespace f5::makham {
     using coroutine_handle = std::experimental::coroutine_handle<T>;
     using suspend_always = std::experimental::suspend_always;
     using suspend_never = std::experimental::suspend_never;
+    using std::experimental::noop_coroutine;
 }
 #endif
+
+
+namespace f5::makham {
+
+
+    /// ## Awaiters
+    /**
+     * `awaiter_t<A>` is what the `await_` functions are called on when an
+     * lvalue `A` is awaited. That is `A &` itself, unless `A` has a member
+     * `operator co_await`, in which case it is whatever that returns.
+     * `await_result_t<A>` is the type awaiting an `A` produces.
+     */
+    template<typename A, typename = void>
+    struct awaiter_of {
+        using type = A &;
+    };
+    template<typename A>
+    struct awaiter_of<
+            A,
+            std::void_t<decltype(std::declval<A &>().operator co_await())>> {
+        using type = decltype(std::declval<A &>().operator co_await());
+    };
+    template<typename A>
+    using awaiter_t = typename awaiter_of<A>::type;
+
+    template<typename A>
+    using await_result_t =
+            decltype(std::declval<awaiter_t<A>>().await_resume());
+
+
+    /// ## Lazy awaitables
+    /**
+     * True for awaitables that only start their work when they are
+     * awaited, and then run it on the awaiting thread. `when_all` and
+     * `when_any` start these on the executor in parallel, rather than one
+     * after another on the awaiting thread.
+     */
+    template<typename A>
+    struct is_lazy : std::false_type {};
+    template<typename A>
+    constexpr bool is_lazy_v = is_lazy<A>::value;
+
+
+}
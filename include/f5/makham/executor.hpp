@@ -12,41 +12,314 @@
 #include <thread-pool/fixed_function.hpp>
 #include <f5/makham/coroutine.hpp>
 
-#ifdef MAKHAM_STDOUT_TRACE
-#include <iostream>
-#endif
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 
 namespace f5::makham {
 
 
+    class timer;
+    namespace detail {
+        struct io_handle;
+        struct ring_op;
+    }
+
+
     /// Fixes size for the closure allowed when posting functions
     /// to the executor.
     using function_type = tp::FixedFunction<void(), 128>;
 
 
-    /// Execute the function in the Makham executor's thread pool.
-    void post(function_type);
-
-    /// Resume this coroutine handle as a new job in the Makham
-    /// executor's thread pool.
-    inline void post(coroutine_handle<> coro) {
-        if (coro) {
-            post([coro]() mutable {
-#ifdef MAKHAM_STDOUT_TRACE
-                if (not coro) {
-                    std::cout << "What happened to my coro?" << std::endl;
-                    return;
-                }
-#endif
-                coro.resume();
-            });
-        } else {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Somebody wanted to resume a NULL coro" << std::endl;
-#endif
+    /// ## Priority
+    /**
+     * Each executor has a lane per priority. Its workers drain the high
+     * lane first, but after a run of high priority jobs a normal one is
+     * given a turn so the normal lane can't be starved.
+     *
+     * Work posted without a priority, which includes resuming coroutines
+     * and starting eager ones, inherits the priority of the job running
+     * on the calling thread. A coroutine can change its own priority, and
+     * so that of the work it goes on to start, with:
+     *
+     * ```cpp
+     * co_await f5::makham::with_priority(f5::makham::priority::high);
+     * ```
+     */
+    enum class priority { normal, high };
+
+    /// The priority of the job running on the calling thread. Normal on
+    /// threads outside of the executors.
+    priority current_priority() noexcept;
+
+
+    /// ## Worker metrics
+    /**
+     * A snapshot of what one of an executor's worker threads has been
+     * doing. All of the counts are totals since the executor started.
+     */
+    struct worker_metrics {
+        /// Jobs the worker has started running
+        std::size_t executed = {};
+        /// Other workers it tried to steal jobs from, and how often it did
+        std::size_t steal_attempts = {}, steals = {};
+        /// Times its thread went to sleep for lack of work
+        std::size_t parks = {};
+        /// Time it has spent with nothing to run
+        std::chrono::nanoseconds idle = {};
+        /// Jobs waiting in its queues right now, not counting the overflow
+        std::size_t queue_depth = {};
+        /// Jobs posted to it that went to the overflow
+        std::size_t overflowed = {};
+        /// Sampled times from posting a coroutine until it resumed. Entry
+        /// `i` counts those under 2^i nanoseconds, but at least half that.
+        /// The last entry counts everything longer too
+        std::array<std::size_t, 32> latency = {};
+    };
+
+
+    /// ## Executor
+    /**
+     * A thread pool that coroutines and functions are posted to. There is
+     * a process wide default executor, but other executors can be created
+     * to keep different kinds of work apart, for example so that latency
+     * sensitive coroutines never queue behind bulk batch work.
+     *
+     * Each executor knows which threads are its own. The free `post`
+     * functions, and so every eager coroutine, use the executor of the
+     * calling thread, falling back to the default executor when called
+     * from any other thread. A coroutine therefore stays on whichever
+     * executor it was last resumed on, and can move to another with
+     * `co_await resume_on(other)`.
+     *
+     * Jobs still queued when an executor is destroyed are never run, so an
+     * executor must outlive the coroutines that use it.
+     */
+    class executor {
+        struct impl;
+        std::unique_ptr<impl> pimpl;
+
+      public:
+        struct options {
+            /// Number of worker threads, zero means one per hardware thread
+            std::size_t threads = {};
+            /// Length of each worker's queues. Must be a power of two
+            std::size_t queue_size = 1024;
+            /// Worker threads are named this with their index appended
+            std::string name = "makham";
+            /// The CPUs of each node. When given the workers are split
+            /// between the nodes and pinned to them, and idle workers
+            /// steal from their own node first. `numa_nodes` returns the
+            /// machine's real nodes, but any split of the CPUs can be used
+            std::vector<std::vector<std::size_t>> nodes = {};
+            /// High priority jobs a worker runs in a row before it gives
+            /// a normal one a turn
+            std::size_t starvation_limit = 32;
+            /// One in this many coroutine posts is timed until it resumes,
+            /// for the latency histograms. Zero turns timing off
+            std::size_t latency_sampling = 64;
+            /// Run file reads and writes through io_uring where the kernel
+            /// supports it, rather than on a few blocking threads
+            bool io_uring = true;
+        };
+
+        executor();
+        explicit executor(options);
+        ~executor();
+
+        executor(executor const &) = delete;
+        executor &operator=(executor const &) = delete;
+
+        /// Execute the function in one of this executor's threads.
+        void post(function_type, priority = current_priority());
+        /// Resume the coroutine in one of this executor's threads. Only the
+        /// handle itself is queued, so unlike posting a function this
+        /// never allocates. The posts sampled for the latency histograms
+        /// take a small record from the frame pool instead.
+        void post(coroutine_handle<>, priority = current_priority());
+        /// Typed handles would otherwise be ambiguous between the two
+        /// overloads above as both need a user defined conversion.
+        template<typename P>
+        void post(coroutine_handle<P> coro, priority p = current_priority()) {
+            post(coroutine_handle<>{coro}, p);
         }
+        /// Resume all of the coroutines, spreading them across this
+        /// executor's threads. Each thread's share is queued with a single
+        /// atomic operation. None of the handles may be null.
+        void post_bulk(
+                coroutine_handle<> const *handles,
+                std::size_t count,
+                priority = current_priority());
+
+        /// Resume the timer's coroutine in this executor once its deadline
+        /// has passed. See `sleep_for` in `timer.hpp`
+        void start(timer &);
+        /// Stop a started timer. Returns `false` if it has already expired,
+        /// in which case its coroutine has been, or is about to be, posted
+        bool cancel(timer &);
+
+        /// Resume the coroutines waiting on the handle's file descriptor in
+        /// this executor whenever it becomes ready. See `socket` in
+        /// `io.hpp`
+        void watch(detail::io_handle &);
+        /// Stop watching the handle, which is freed once it is safe to
+        void unwatch(std::unique_ptr<detail::io_handle>);
+
+        /// Run the operation and then resume its coroutine in this
+        /// executor. See `file` in `file.hpp`
+        void submit(detail::ring_op &);
+        /// Whether file operations go through io_uring
+        bool uses_io_uring() const noexcept;
+
+        /// Run one job waiting in this executor on the calling thread.
+        /// Returns `false` if there was nothing to run.
+        bool run_pending();
+
+        /// The number of jobs that have been posted when the queue they
+        /// were meant for was full. They are held on an unbounded overflow
+        /// list instead, so a non-zero count only means the queue size is
+        /// too small for the load.
+        std::size_t overflow_count() const;
+
+        /// Snapshot of each worker's metrics, indexed by worker. Cheap
+        /// enough to be polled by monitoring.
+        std::vector<worker_metrics> metrics() const;
+
+        /// The executor whose thread is calling, or `nullptr`. See also
+        /// `use_executor`
+        static executor *current() noexcept;
+    };
+
+
+    /// ## Default executor
+    /**
+     * Created on first use. `configure_default_executor` may be called
+     * before then to change its options. Calling it afterwards throws
+     * `std::logic_error`.
+     */
+    executor &default_executor();
+    void configure_default_executor(executor::options);
+
+    /// The CPUs of each of the machine's NUMA nodes, if they are known
+    std::vector<std::vector<std::size_t>> numa_nodes();
+
+    /// ## Use executor
+    /**
+     * Makes the executor the current one of the calling thread for as long
+     * as this exists. A thread outside of the executors can use this to
+     * choose where the coroutines it starts run:
+     *
+     * ```cpp
+     * f5::makham::use_executor const batch_work{batch};
+     * auto result = f5::makham::sync_wait(process(items));
+     * ```
+     */
+    class use_executor {
+        executor *outer;
+
+      public:
+        explicit use_executor(executor &);
+        ~use_executor();
+
+        use_executor(use_executor const &) = delete;
+        use_executor &operator=(use_executor const &) = delete;
+    };
+
+
+    /// The executor whose thread is calling, or the default one
+    inline executor &current_executor() {
+        auto *e = executor::current();
+        return e ? *e : default_executor();
+    }
+
+
+    /// Execute the function in the current executor.
+    inline void post(function_type f, priority p = current_priority()) {
+        current_executor().post(std::move(f), p);
+    }
+
+    /// Resume this coroutine handle as a new job in the current executor.
+    inline void post(coroutine_handle<> coro, priority p = current_priority()) {
+        current_executor().post(coro, p);
+    }
+    template<typename P>
+    inline void
+            post(coroutine_handle<P> coro, priority p = current_priority()) {
+        post(coroutine_handle<>{coro}, p);
+    }
+
+    /// Resume all of the coroutines in the current executor.
+    inline void post_bulk(
+            std::vector<coroutine_handle<>> const &handles,
+            priority p = current_priority()) {
+        current_executor().post_bulk(handles.data(), handles.size(), p);
+    }
+
+    /// Run one job waiting in the current executor on the calling thread.
+    /// Returns `false` if there was nothing to run.
+    inline bool run_pending() { return current_executor().run_pending(); }
+
+    /// Overflow count of the default executor
+    inline std::size_t overflow_count() {
+        return default_executor().overflow_count();
     }
 
 
+    /// ## Schedule
+    /**
+     * Awaitable that suspends the coroutine and then posts it so that it
+     * continues as a new job in an executor, by default the current one.
+     * Eager coroutines use this as their initial suspend point, which
+     * ensures they can't be resumed by a worker before they have suspended.
+     */
+    struct schedule {
+        executor *on = nullptr;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> h) const {
+            if (on) {
+                on->post(h);
+            } else {
+                post(h);
+            }
+        }
+        void await_resume() const noexcept {}
+    };
+
+
+    /// ## Resume on
+    /**
+     * Move the awaiting coroutine on to another executor:
+     *
+     * ```cpp
+     * co_await f5::makham::resume_on(batch);
+     * ```
+     */
+    inline schedule resume_on(executor &e) { return schedule{&e}; }
+
+
+    /// ## With priority
+    /**
+     * Awaitable that re-posts the coroutine to the current executor at the
+     * given priority. Everything it posts from then on inherits the new
+     * priority.
+     */
+    struct with_priority {
+        priority lane;
+
+        explicit with_priority(priority p) : lane{p} {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> h) const {
+            current_executor().post(h, lane);
+        }
+        void await_resume() const noexcept {}
+    };
+
+
 }
@@ -0,0 +1,190 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/executor.hpp>
+#include <f5/makham/task.hpp>
+
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+
+
+namespace f5::makham {
+
+
+    namespace detail {
+
+
+        /// ### Ring operation
+        /**
+         * A read or write at an offset, run by the I/O ring of an executor
+         * on behalf of the coroutine waiting for it. It lives in that
+         * coroutine's frame, so submitting one never allocates.
+         */
+        struct ring_op {
+            enum class kind : std::uint8_t { read, write };
+
+            kind what;
+            int fd;
+            void *buffer;
+            std::uint32_t size;
+            std::uint64_t offset;
+            coroutine_handle<> coro = {};
+            priority lane = priority::normal;
+            /// The number of bytes transferred, or the negated `errno`
+            int result = {};
+        };
+
+
+        /// Awaiting it submits the operation and suspends until it is done.
+        /// Without a file descriptor it fails with `EBADF` straight away
+        class ring_awaitable {
+            executor *owner;
+            ring_op op;
+
+          public:
+            /// The kernel caps a single transfer a little under 2GB, so
+            /// larger ones are cut down to this
+            static constexpr std::size_t largest = 1u << 30;
+
+            ring_awaitable(
+                    executor *e,
+                    ring_op::kind k,
+                    int fd,
+                    void *buffer,
+                    std::size_t size,
+                    std::uint64_t offset)
+            : owner{e},
+              op{k, fd, buffer,
+                 static_cast<std::uint32_t>(std::min(size, largest)),
+                 offset} {
+                if (fd < 0 || not owner) { op.result = -EBADF; }
+            }
+
+            bool await_ready() const noexcept { return op.result < 0; }
+            void await_suspend(coroutine_handle<> h) {
+                op.coro = h;
+                op.lane = current_priority();
+                owner->submit(op);
+            }
+            std::size_t await_resume() const {
+                if (op.result < 0) {
+                    throw std::system_error{
+                            -op.result, std::system_category(),
+                            op.what == ring_op::kind::read ? "read"
+                                                           : "write"};
+                }
+                return op.result;
+            }
+        };
+
+
+        /// ### I/O ring
+        /**
+         * Each executor has one. Where the kernel supports it the
+         * operations go through an io_uring: whatever has been submitted
+         * since its thread last looked is handed to the kernel with a
+         * single `io_uring_enter`, which also collects the completions so
+         * far, and the coroutines they wake are posted in bulk. Otherwise
+         * a few blocking threads run the operations one at a time.
+         *
+         * The threads only start when the first operation is submitted,
+         * and are stopped by the executor's destructor. Operations still
+         * running then never complete.
+         */
+        class io_ring {
+            struct impl;
+            std::unique_ptr<impl> pimpl;
+
+          public:
+            /// Falls back to blocking threads if `uring` is `false`
+            io_ring(executor &, std::string name, bool uring);
+            ~io_ring();
+
+            void submit(ring_op &);
+            bool uses_io_uring() const noexcept;
+        };
+
+
+    }
+
+
+    /// ## Files
+    /**
+     * A file whose reads and writes suspend the awaiting coroutine while
+     * the executor's I/O ring runs them, rather than blocking its thread:
+     *
+     * ```cpp
+     * auto f = f5::makham::open_file("/var/log/app.log");
+     * char line[128];
+     * auto const n = co_await f.read(line, sizeof(line), offset);
+     * ```
+     *
+     * Every operation gives the offset it starts at, so any number of
+     * coroutines may use the same file at once. Waiting coroutines are
+     * resumed by the file's executor, at the priority they waited with.
+     * The file must not be closed or destroyed while an operation is
+     * running. Errors are thrown as `std::system_error`.
+     */
+    class file {
+        int fd = -1;
+        executor *owner = nullptr;
+
+      public:
+        file() = default;
+        /// Take ownership of the file descriptor
+        explicit file(int f, executor &e = current_executor())
+        : fd{f}, owner{&e} {}
+
+        file(file &&f) noexcept
+        : fd{std::exchange(f.fd, -1)},
+          owner{std::exchange(f.owner, nullptr)} {}
+        file &operator=(file &&f) noexcept {
+            close();
+            fd = std::exchange(f.fd, -1);
+            owner = std::exchange(f.owner, nullptr);
+            return *this;
+        }
+        ~file() { close(); }
+
+        explicit operator bool() const noexcept { return fd >= 0; }
+        int native_handle() const noexcept { return fd; }
+        /// The current size of the file in bytes
+        std::uint64_t size() const;
+
+        void close() noexcept;
+
+        /// Read up to the size of the buffer starting at the offset.
+        /// Produces zero at the end of the file
+        detail::ring_awaitable
+                read(void *buffer, std::size_t size, std::uint64_t offset) {
+            return {owner, detail::ring_op::kind::read, fd, buffer, size,
+                    offset};
+        }
+        /// Write all of the bytes starting at the offset
+        task<std::size_t>
+                write(void const *, std::size_t, std::uint64_t offset);
+    };
+
+
+    /// Open the file, throwing `std::system_error` if it can't be
+    file open_file(
+            std::string const &path, int flags = O_RDONLY, mode_t mode = 0666);
+
+
+}
@@ -0,0 +1,69 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+
+namespace f5::makham {
+
+
+    /// ## Coroutine frame pool
+    /**
+     * Thread local, size class based free lists for coroutine frames. A
+     * frame freed on the thread that allocated it goes straight back on to
+     * that thread's free list. Frames freed on any other thread are
+     * gathered into batches that are handed back to the owning thread with
+     * a single atomic operation.
+     *
+     * The promise types only allocate from here when the library is built
+     * with the `F5_MAKHAM_FRAME_POOL` CMake option.
+     */
+    namespace frame_pool {
+
+
+        /// Process wide counters
+        struct statistics {
+            /// Allocations served from a free list
+            std::size_t hits = {};
+            /// Allocations that had to go to the global `operator new`
+            std::size_t misses = {};
+            /// Total bytes requested through the pool
+            std::size_t bytes = {};
+        };
+        statistics stats();
+
+
+        /// Allocate and free frame memory
+        void *allocate(std::size_t);
+        void deallocate(void *) noexcept;
+
+
+    }
+
+
+    /// ## Pooled frames
+    /**
+     * Promise types derive from this so that the frames of their coroutines
+     * are allocated from the frame pool, when it is switched on.
+     */
+    struct pooled_frame {
+#ifdef F5_MAKHAM_FRAME_POOL
+        static void *operator new(std::size_t bytes) {
+            return frame_pool::allocate(bytes);
+        }
+        static void operator delete(void *frame) noexcept {
+            frame_pool::deallocate(frame);
+        }
+#endif
+    };
+
+
+}
@@ -10,12 +10,11 @@
 
 
 #include <f5/makham/executor.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/trace.hpp>
 
-#include <future>
-
-#ifdef MAKHAM_STDOUT_TRACE
-#include <iostream>
-#endif
+#include <optional>
 
 
 namespace f5::makham {
@@ -28,14 +27,17 @@ namespace f5::makham {
     /// ## Future
     /**
      * Spawns a coroutine which will run asynchronously and whose result can
-     * be fetched from a `std::future. This can be used to bridge from a thread
+     * be fetched using `get`. This can be used to bridge from a thread
      * running outside of the coroutine executor to a coroutine, for example
-     * from `main`.
+     * from `main`. The result is stored in the coroutine frame, so no shared
+     * state is allocated.
      *
      * The calling thread will suspend until the result is ready, so this must
      * never be used between coroutines as the thread waiting on the future
      * will not become available to run other coroutines. This can result in a
-     * deadlock at worst, but at best will be very inefficient.
+     * deadlock at worst, but at best will be very inefficient. Passing
+     * `waiting::help` to `get` lets the thread run other jobs from the
+     * executor while it waits.
      */
     template<typename R>
     class future final {
@@ -48,39 +50,20 @@ namespace f5::makham {
         future(future const &) = delete;
         future &operator=(future const &) = delete;
         /// Movable
-        future(future &&t) noexcept : coro(std::exchange(t.coro, {})) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future move construct future" << std::endl;
-#endif
-        }
+        future(future &&t) noexcept : coro(std::exchange(t.coro, {})) {}
         future &operator=(future &&t) noexcept {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future move assign future" << std::endl;
-#endif
             coro = std::exchange(t.coro, {});
         }
         ~future() {
             // TODO If there has been no get() we must wait before
             // we destroy this thing...
-            if (coro) {
-#ifdef MAKHAM_STDOUT_TRACE
-                if (not gotten) {
-                    std::cout << "Future not got() !!!!" << std::endl;
-                }
-                std::cout << "Future destructed -- taking the promise with it"
-                          << std::endl;
-#endif
-                coro.destroy();
-#ifdef MAKHAM_STDOUT_TRACE
-            } else {
-                std::cout << "Future destructed -- no coro" << std::endl;
-#endif
-            }
+            if (coro) trace::destroy(coro);
         }
 
-        R get() {
+        R get(waiting w = waiting::block) {
             gotten = true;
-            return coro.promise().fp.get_future().get();
+            coro.promise().done.wait(w);
+            return coro.promise().get_value();
         }
 
         /// Wrap an awaitable and return a future to its result
@@ -94,66 +77,75 @@ namespace f5::makham {
         typename promise_type::handle_type coro;
 
         future(typename promise_type::handle_type h) : coro(h) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future constructed" << std::endl;
-#endif
-            post(coro);
+            trace::record(trace::event::created, coro);
         }
     };
 
 
+    /// The future's result is only published once the coroutine has
+    /// suspended for the last time, otherwise the thread calling `get` could
+    /// destroy the frame while the coroutine is still running.
+    struct future_final_awaiter {
+        bool await_ready() const noexcept { return false; }
+        template<typename P>
+        void await_suspend(coroutine_handle<P> h) const noexcept {
+            trace::record(trace::event::completed, h);
+            h.promise().publish();
+        }
+        void await_resume() const noexcept {}
+    };
+
+
     template<typename R>
-    struct future_promise final {
+    struct future_promise final : public pooled_frame {
         using handle_type = coroutine_handle<future_promise>;
 
-        std::promise<R> fp = {};
+        detail::sync_event done;
+        std::optional<R> value = {};
+        std::exception_ptr eptr = {};
 
         auto get_return_object() {
             return future<R>{handle_type::from_promise(*this)};
         }
         auto return_value(R v) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future co_returned value" << std::endl;
-#endif
-            fp.set_value(std::move(v));
+            value = std::move(v);
             return suspend_never{};
         }
         void unhandled_exception() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future exception caught" << std::endl;
-#endif
-            fp.set_exception(std::current_exception());
+            eptr = std::current_exception();
+        }
+        void publish() { done.set(); }
+        R get_value() {
+            if (eptr) std::rethrow_exception(eptr);
+            return std::move(*value);
         }
 
-        auto initial_suspend() { return suspend_always{}; }
-        auto final_suspend() { return suspend_always{}; }
+        auto initial_suspend() { return schedule{}; }
+        auto final_suspend() noexcept { return future_final_awaiter{}; }
     };
     template<>
-    struct future_promise<void> final {
+    struct future_promise<void> final : public pooled_frame {
         using handle_type = coroutine_handle<future_promise>;
 
-        std::promise<void> fp = {};
+        detail::sync_event done;
+        std::exception_ptr eptr = {};
 
         auto get_return_object() {
             return future<void>{handle_type::from_promise(*this)};
         }
         auto return_void() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future co_returned void" << std::endl;
-#endif
-            fp.set_value();
             return suspend_never{};
         }
         void unhandled_exception() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Future exception caught" << std::endl;
-#endif
-            fp.set_exception(std::current_exception());
+            eptr = std::current_exception();
+        }
+        void publish() { done.set(); }
+        void get_value() {
+            if (eptr) std::rethrow_exception(eptr);
         }
 
-        auto initial_suspend() { return suspend_always{}; }
-        auto final_suspend() { return suspend_always{}; }
+        auto initial_suspend() { return schedule{}; }
+        auto final_suspend() noexcept { return future_final_awaiter{}; }
     };
 
-
 }
@@ -8,14 +8,11 @@
 
 #pragma once
 
-#include <iostream>
-
 #include <f5/makham/coroutine.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/trace.hpp>
 #include <optional>
-
-#ifdef MAKHAM_STDOUT_TRACE
-#include <iostream>
-#endif
+#include <utility>
 
 
 namespace f5::makham {
@@ -32,9 +29,7 @@ namespace f5::makham {
         handle_type coro;
 
         generator(handle_type h) : coro(h) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Created a generator" << std::endl;
-#endif
+            trace::record(trace::event::created, coro);
         }
 
       public:
@@ -49,7 +44,7 @@ namespace f5::makham {
             coro = std::exchange(t.coro, {});
         }
         ~generator() {
-            if (coro) coro.destroy();
+            if (coro) trace::destroy(coro);
         }
 
         /// Iteration
@@ -59,10 +54,7 @@ namespace f5::makham {
 
             iterator() : coro{} {}
             iterator(generator *s) : coro{std::exchange(s->coro, {})} {
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "Created an iterator" << std::endl;
-#endif
-                coro.resume();
+                trace::resume(coro);
                 throw_if_needed();
             }
 
@@ -77,7 +69,7 @@ namespace f5::makham {
             iterator &operator=(iterator const &) = delete;
 
             ~iterator() {
-                if (coro) { coro.destroy(); }
+                if (coro) { trace::destroy(coro); }
             }
 
             Y operator*() {
@@ -85,10 +77,10 @@ namespace f5::makham {
             }
 
             auto &operator++() {
-                coro.resume();
+                trace::resume(coro);
                 throw_if_needed();
                 if (not coro.promise().value) {
-                    std::exchange(coro, {}).destroy();
+                    trace::destroy(std::exchange(coro, {}));
                 }
                 return *this;
             }
@@ -110,25 +102,19 @@ namespace f5::makham {
 
 
     template<typename Y>
-    struct generator_promise {
+    struct generator_promise : public pooled_frame {
         std::optional<Y> value = {};
         std::exception_ptr eptr = {};
 
         using handle_type = coroutine_handle<generator_promise>;
 
         auto yield_value(Y y) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Got a value from a co_yield" << std::endl;
-#endif
             value = std::move(y);
             return suspend_always{};
         }
         void unhandled_exception() { eptr = std::current_exception(); }
 
         auto return_void() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "generator ended" << std::endl;
-#endif
             value = {};
             return suspend_never{};
         }
@@ -137,7 +123,11 @@ namespace f5::makham {
             return generator<Y>{handle_type::from_promise(*this)};
         }
         auto initial_suspend() { return suspend_always{}; }
-        auto final_suspend() { return suspend_always{}; }
+        auto final_suspend() noexcept {
+            trace::record(
+                    trace::event::completed, handle_type::from_promise(*this));
+            return suspend_always{};
+        }
     };
 
 
@@ -0,0 +1,185 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/executor.hpp>
+#include <f5/makham/task.hpp>
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+
+namespace f5::makham {
+
+
+    namespace detail {
+
+
+        /// ### I/O readiness
+        /**
+         * Whether a file descriptor may have become ready in one direction
+         * since it was last waited for, or the coroutine waiting for it to.
+         * Both are a single atomic word, so the reactor wakes the waiter
+         * with one exchange and a readiness event can never be lost between
+         * a system call saying it would block and the wait starting.
+         *
+         * Awaiting it suspends the coroutine until the next event, unless
+         * there has been one since the last wait. Only one coroutine may
+         * wait in each direction at a time.
+         */
+        class io_ready {
+            static constexpr std::uintptr_t idle = 0u, ready = 1u;
+            std::atomic<std::uintptr_t> word = idle;
+            priority waiting_lane = priority::normal;
+
+          public:
+            /// Called by the reactor on an event. Returns the waiting
+            /// coroutine, if there is one
+            coroutine_handle<> notify() noexcept {
+                auto const old =
+                        word.exchange(ready, std::memory_order_acq_rel);
+                if (old == idle || old == ready) {
+                    return {};
+                } else {
+                    return coroutine_handle<>::from_address(
+                            reinterpret_cast<void *>(old));
+                }
+            }
+            /// The priority to resume the waiting coroutine at
+            priority lane() const noexcept { return waiting_lane; }
+
+            bool await_ready() const noexcept { return false; }
+            bool await_suspend(coroutine_handle<> h) noexcept {
+                waiting_lane = current_priority();
+                auto expected = idle;
+                if (word.compare_exchange_strong(
+                            expected,
+                            reinterpret_cast<std::uintptr_t>(h.address()),
+                            std::memory_order_acq_rel)) {
+                    return true;
+                } else {
+                    /// An event has come in, so try again straight away
+                    word.store(idle, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            void await_resume() const noexcept {}
+        };
+
+
+        /// A non-blocking file descriptor and its waiters
+        struct io_handle {
+            int const fd;
+            executor &owner;
+            io_ready readable = {}, writable = {};
+
+            io_handle(int f, executor &e) : fd{f}, owner{e} {}
+        };
+
+
+        /// ### Reactor
+        /**
+         * Each executor has one. It waits for events on the file
+         * descriptors of all the executor's sockets with edge triggered
+         * epoll, and posts the coroutines they wake. Its thread only starts
+         * when the first socket is added, and is stopped by the executor's
+         * destructor.
+         */
+        class reactor {
+            struct impl;
+            std::unique_ptr<impl> pimpl;
+
+          public:
+            reactor(executor &, std::string name);
+            ~reactor();
+
+            void add(io_handle &);
+            /// The handle is freed once the reactor can no longer be
+            /// handling an event for it
+            void remove(std::unique_ptr<io_handle>);
+        };
+
+
+    }
+
+
+    /// ## Sockets
+    /**
+     * A non-blocking socket whose operations suspend the awaiting coroutine
+     * rather than block its thread, so a handful of threads can serve any
+     * number of connections:
+     *
+     * ```cpp
+     * f5::makham::async<void> echo(f5::makham::socket s) {
+     *     char buffer[4096];
+     *     while (auto const n = co_await s.read(buffer, sizeof(buffer))) {
+     *         co_await s.write(buffer, n);
+     *     }
+     * }
+     * ```
+     *
+     * Waiting coroutines are resumed by the socket's executor, at the
+     * priority they waited with. At most one coroutine may be reading and
+     * one writing at a time, and the socket must not be closed or destroyed
+     * while either is waiting. Errors are thrown as `std::system_error`.
+     */
+    class socket {
+        std::unique_ptr<detail::io_handle> handle;
+
+        friend task<socket> connect(sockaddr_storage, socklen_t);
+
+      public:
+        socket() = default;
+        /// Take ownership of the file descriptor, which is made non-blocking
+        explicit socket(int fd, executor & = current_executor());
+
+        socket(socket &&) = default;
+        socket &operator=(socket &&s) {
+            close();
+            handle = std::move(s.handle);
+            return *this;
+        }
+        ~socket() { close(); }
+
+        explicit operator bool() const noexcept { return bool(handle); }
+        int native_handle() const noexcept { return handle ? handle->fd : -1; }
+        /// The port the socket is bound to
+        std::uint16_t local_port() const;
+
+        void close();
+
+        /// Read whatever is available, up to the size of the buffer.
+        /// Produces zero at the end of the stream
+        task<std::size_t> read(void *, std::size_t);
+        /// Write all of the bytes
+        task<std::size_t> write(void const *, std::size_t);
+        /// Accept a connection on a listening socket
+        task<socket> accept();
+    };
+
+
+    /// Create a socket bound to the address and listening on it
+    socket listen(sockaddr const *, socklen_t, int backlog = SOMAXCONN);
+    /// Connect a stream socket to the address
+    task<socket> connect(sockaddr_storage, socklen_t);
+    /// The address is copied, so it needn't outlive the task
+    inline task<socket> connect(sockaddr const *address, socklen_t length) {
+        sockaddr_storage copy{};
+        std::memcpy(&copy, address, length);
+        return connect(copy, length);
+    }
+
+
+}
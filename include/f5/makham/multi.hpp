@@ -9,18 +9,14 @@
 #pragma once
 
 
-#include <iostream>
-
 #include <f5/makham/executor.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/trace.hpp>
 
 #include <atomic>
-#include <mutex>
+#include <cstdint>
+#include <exception>
 #include <optional>
-#include <vector>
-
-#ifdef MAKHAM_STDOUT_TRACE
-#include <iostream>
-#endif
 
 
 namespace f5::makham {
@@ -29,6 +25,18 @@ namespace f5::makham {
     /**
      * A wrapper for an awaitable that allows us to have more than one
      * client awaiting.
+     *
+     * The clients still waiting for the result are kept on a lock free
+     * stack whose nodes live in the awaiters, i.e. in the awaiting
+     * coroutines' frames. Once the result is in the whole stack is taken
+     * with a single atomic exchange and every client on it is posted.
+     *
+     * The result, or the exception, is stored once and shared. Awaiting
+     * produces a `const` reference to it, which stays valid for as long as
+     * the `multi` that was awaited, or any copy of it, does. Waiters are
+     * only posted once the wrapped coroutine has suspended for the last
+     * time, whether it produced a value or threw, so the last copy can be
+     * dropped by any of them.
      */
     template<
             typename A,
@@ -36,7 +44,12 @@ namespace f5::makham {
                     std::declval<typename A::promise_type>().get_value())>
     class multi final {
         using result_type = R;
-        std::optional<result_type> *pvalue;
+
+        /// A client waiting for the result
+        struct waiter {
+            coroutine_handle<> handle = {};
+            waiter *next = nullptr;
+        };
 
         struct wrapper {
             struct promise_type;
@@ -44,168 +57,122 @@ namespace f5::makham {
 
             handle_type coro;
 
-            wrapper(handle_type h) : coro{h} {}
+            wrapper(handle_type h) : coro{h} {
+                trace::record(trace::event::created, coro);
+            }
             wrapper(wrapper const &w) : coro(w.coro) {
                 ++coro.promise().wraps;
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "wrapper copied" << std::endl;
-#endif
-            }
-            wrapper(wrapper &&w) : coro{std::exchange(w.coro, {})} {
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "wrapper moved" << std::endl;
-#endif
             }
+            wrapper(wrapper &&w) : coro{std::exchange(w.coro, {})} {}
             ~wrapper() {
                 if (coro) {
                     auto const count = --coro.promise().wraps;
-                    if (not count) {
-#ifdef MAKHAM_STDOUT_TRACE
-                        std::cout << "wrapper destructed -- taking promise"
-                                  << std::endl;
-#endif
-                        coro.destroy();
-#ifdef MAKHAM_STDOUT_TRACE
-                    } else {
-                        std::cout << "wrapper destructed -- promise survives"
-                                  << std::endl;
-#endif
-                    }
-#ifdef MAKHAM_STDOUT_TRACE
-                } else {
-                    std::cout << "wrapper destructed -- only move husk left"
-                              << std::endl;
-#endif
+                    if (not count) { trace::destroy(coro); }
                 }
             }
 
-            struct promise_type {
+            struct promise_type : public pooled_frame {
                 /// Counter for the number of wrappers
                 std::atomic<std::size_t> wraps = 1u;
 
-                /// Used to signal that the wrapped coroutine is ready
-                std::atomic<bool> ready = false;
-                result_type value;
-
-                /// Used for overspill only
-                std::mutex bottleneck;
-                std::vector<coroutine_handle<>> overspill;
-
-                /// Enqueue if the result isn't in yet, otherwise we just resume
-                /// the handle.
-                void enqueue(coroutine_handle<> h) {
-                    if (ready) {
-#ifdef MAKHAM_STDOUT_TRACE
-                        std::cout << "Enqueued ready, just resume" << std::endl;
-#endif
-                        /// The result is already there, so we can just resume
-                        post(h);
-                    } else {
-                        {
-#ifdef MAKHAM_STDOUT_TRACE
-                            std::cout << "Enqueued not ready, listing"
-                                      << std::endl;
-#endif
-                            std::lock_guard<std::mutex> lock{bottleneck};
-                            overspill.push_back(h);
-                        }
-                        if (ready) {
-#ifdef MAKHAM_STDOUT_TRACE
-                            std::cout << "Enqueued, but, oops, now ready!"
-                                      << std::endl;
-#endif
-                            resume();
-                        }
-                    }
+                /// The shared result
+                std::optional<result_type> value = {};
+                std::exception_ptr eptr = {};
+
+                /// The stack of waiters, or `ready` once the result is in
+                static constexpr std::uintptr_t ready = 1u;
+                std::atomic<std::uintptr_t> waiting = {};
+
+                bool is_ready() const noexcept {
+                    return waiting.load(std::memory_order_acquire) == ready;
                 }
-                /// Calls to this need to be done very carefully
-                void resume() {
-                    std::lock_guard<std::mutex> lock{bottleneck};
-                    for (auto &h : overspill) {
-#ifdef MAKHAM_STDOUT_TRACE
-                        std::cout << "Resuming awaiting coro" << std::endl;
-#endif
-                        post(h);
+
+                /// Push the waiter unless the result is already in, in which
+                /// case this returns `false` and the waiter mustn't suspend.
+                bool enqueue(waiter &w) {
+                    auto head = waiting.load(std::memory_order_acquire);
+                    do {
+                        if (head == ready) { return false; }
+                        w.next = reinterpret_cast<waiter *>(head);
+                    } while (not waiting.compare_exchange_weak(
+                            head, reinterpret_cast<std::uintptr_t>(&w),
+                            std::memory_order_release,
+                            std::memory_order_acquire));
+                    return true;
+                }
+                /// Only publishes the result once the coroutine has
+                /// suspended for the last time. A waiter that is posted may
+                /// drop the last copy of the `multi`, which destroys the
+                /// frame, so nothing in it may be used after the exchange
+                struct final_awaiter {
+                    bool await_ready() const noexcept { return false; }
+                    void await_suspend(handle_type h) noexcept {
+                        trace::record(trace::event::completed, h);
+                        auto *w = reinterpret_cast<waiter *>(
+                                h.promise().waiting.exchange(
+                                        ready, std::memory_order_acq_rel));
+                        while (w) {
+                            /// The waiter may be destroyed as soon as it
+                            /// has been posted
+                            auto *const next = w->next;
+                            post(w->handle);
+                            w = next;
+                        }
                     }
-                    overspill.clear();
+                    void await_resume() const noexcept {}
                 };
 
                 /// Coroutine promise API
                 auto get_return_object() {
-#ifdef MAKHAM_STDOUT_TRACE
-                    std::cout << "Created new wrapper instance" << std::endl;
-#endif
                     return wrapper{handle_type::from_promise(*this)};
                 }
                 auto initial_suspend() { return suspend_never{}; }
-                auto final_suspend() {
-#ifdef MAKHAM_STDOUT_TRACE
-                    std::cout << "Stopping at end of wrapper" << std::endl;
-#endif
-                    return suspend_always{};
-                }
+                auto final_suspend() noexcept { return final_awaiter{}; }
                 void unhandled_exception() {
-                    // TODO Handle the exception and pass it on
-                    std::exit(57);
-                }
-                auto return_void() {
-#ifdef MAKHAM_STDOUT_TRACE
-                    std::cout << "Escaped wrapper::create" << std::endl;
-#endif
-                    /// Block new enqueues
-                    if (ready.exchange(true)) {
-                        /// Already returned. This is bad
-                        throw std::runtime_error{
-                                "Coroutine has already been flushed"};
-                    }
-                    resume();
-                    /// We need to do this a second time because it is possible
-                    /// that another handle arrived in the overspill after we
-                    /// set `ready`
-                    resume();
-                    return suspend_never{};
+                    eptr = std::current_exception();
                 }
+                void return_value(result_type v) { value = std::move(v); }
             };
-            static wrapper create(multi *m, A a) {
-                std::optional<result_type> r;
-                m->pvalue = &r;
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "Set pvalue address" << std::endl;
-#endif
-                r = co_await a;
-#ifdef MAKHAM_STDOUT_TRACE
-                std::cout << "Set value" << std::endl;
-#endif
-                co_return;
-            }
+            static wrapper create(A a) { co_return co_await a; }
         } wrapped;
         friend struct wrapper;
 
       public:
-        multi(A &&a) : wrapped{wrapper::create(this, std::move(a))} {}
-        multi(multi const &m) : pvalue{m.pvalue}, wrapped{m.wrapped} {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Multi copied" << std::endl;
-#endif
-        }
-        ~multi() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "multi destructed" << std::endl;
-#endif
-        }
-        /// Awaitable
-        bool await_ready() const { return false; }
-        void await_suspend(coroutine_handle<> awaiting) {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Enqueuing awaiting" << std::endl;
-#endif
-            wrapped.coro.promise().enqueue(awaiting);
+        multi(A &&a) : wrapped{wrapper::create(std::move(a))} {}
+        multi(multi const &m) : wrapped{m.wrapped} {}
+
+        /// ### Awaiter
+        /// Each awaiting coroutine gets its own, which holds its node in the
+        /// stack of waiters.
+        class awaiter {
+            multi &m;
+            waiter node;
+
+          public:
+            awaiter(multi &a) : m{a} {}
+
+            bool await_ready() const {
+                return m.wrapped.coro.promise().is_ready();
+            }
+            bool await_suspend(coroutine_handle<> awaiting) {
+                node.handle = awaiting;
+                return m.wrapped.coro.promise().enqueue(node);
+            }
+            result_type const &await_resume() {
+                auto &p = m.wrapped.coro.promise();
+                if (p.eptr) std::rethrow_exception(p.eptr);
+                return *p.value;
+            }
+        };
+        awaiter operator co_await() { return {*this}; }
+
+        /// Whether the result, or an exception, is in yet
+        bool is_ready() const noexcept {
+            return wrapped.coro.promise().is_ready();
         }
-        result_type await_resume() {
-#ifdef MAKHAM_STDOUT_TRACE
-            std::cout << "Pulling value" << std::endl;
-#endif
-            return **pvalue;
+        /// Whether the wrapped awaitable failed with an exception
+        bool has_exception() const noexcept {
+            return is_ready() && wrapped.coro.promise().eptr;
         }
     };
 
@@ -0,0 +1,285 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/executor.hpp>
+
+#include <atomic>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+
+namespace f5::makham {
+
+
+    namespace detail {
+
+
+        /// Callbacks are intrusive nodes in the state's list
+        struct stop_node {
+            stop_node *prev = nullptr, *next = nullptr;
+            class stop_state *in = nullptr;
+            void (*run)(stop_node &) = nullptr;
+        };
+
+
+        /// ### Stop state
+        /**
+         * Whether a stop has been requested, and the callbacks to run when
+         * it is. A single word holds the flag and a spin lock that guards
+         * the callback list, so the state is small enough to live in every
+         * promise and costs nothing until it is used.
+         *
+         * Callbacks run on the thread that requests the stop, without the
+         * lock held. Removing a callback that is running on another thread
+         * waits for it to finish.
+         */
+        class stop_state {
+            static constexpr unsigned requested_bit = 1u, locked_bit = 2u;
+            std::atomic<unsigned> word = {};
+            stop_node *first = nullptr;
+            stop_node *running = nullptr;
+            std::thread::id runner = {};
+
+            void lock() noexcept;
+            void unlock() noexcept;
+
+          public:
+            stop_state() = default;
+            stop_state(stop_state const &) = delete;
+            stop_state &operator=(stop_state const &) = delete;
+
+            bool stop_requested() const noexcept {
+                return word.load(std::memory_order_acquire) & requested_bit;
+            }
+            /// Returns `false` if a stop had already been requested
+            bool request_stop() noexcept;
+
+            /// Returns `false`, without adding the callback, if a stop has
+            /// already been requested
+            bool add(stop_node &) noexcept;
+            void remove(stop_node &) noexcept;
+        };
+
+
+    }
+
+
+    /// ## Stop tokens
+    /**
+     * A view of a stop state that can be checked for a stop request. The
+     * tokens of coroutines point into their frames, so a token must not be
+     * used after the coroutine it came from has been destroyed. A default
+     * constructed token can never be stopped.
+     */
+    class stop_token {
+        detail::stop_state *state = nullptr;
+
+        template<typename F>
+        friend class stop_callback;
+
+      public:
+        stop_token() noexcept = default;
+        explicit stop_token(detail::stop_state &s) noexcept : state{&s} {}
+
+        bool stop_requested() const noexcept {
+            return state && state->stop_requested();
+        }
+        bool stop_possible() const noexcept { return state; }
+    };
+
+
+    /// ## Stop callbacks
+    /**
+     * Calls the function once a stop is requested on the token, or right
+     * away if one already has been. The callback is removed again when
+     * this is destroyed.
+     */
+    template<typename F>
+    class stop_callback : private detail::stop_node {
+        F function;
+        detail::stop_state *state;
+
+      public:
+        stop_callback(stop_token const &t, F f)
+        : function{std::move(f)}, state{t.state} {
+            run = [](detail::stop_node &n) {
+                static_cast<stop_callback &>(n).function();
+            };
+            if (state && not state->add(*this)) { function(); }
+        }
+        ~stop_callback() {
+            if (state) { state->remove(*this); }
+        }
+
+        stop_callback(stop_callback const &) = delete;
+        stop_callback &operator=(stop_callback const &) = delete;
+    };
+
+
+    /// ## Stoppable promises
+    /**
+     * Promise types derive from this to give their coroutines a stop
+     * state. Awaiting an async from one of these coroutines links the two
+     * until the await completes, so a stop requested on the awaiting
+     * coroutine is passed down to the coroutine it is waiting for, and on
+     * down through everything that is awaiting in turn.
+     */
+    struct stoppable {
+        detail::stop_state stopping;
+
+        stop_token get_stop_token() noexcept { return stop_token{stopping}; }
+        bool request_stop() noexcept { return stopping.request_stop(); }
+    };
+    template<typename P>
+    constexpr bool is_stoppable_v = std::is_base_of_v<stoppable, P>;
+
+
+    namespace detail {
+
+
+        /// ### Stop link
+        /**
+         * Passes a stop requested on one state on to something else that
+         * has a `request_stop`, for as long as it is attached.
+         */
+        class stop_link : private stop_node {
+            stop_state *from = nullptr;
+            void *target = nullptr;
+
+          public:
+            stop_link() = default;
+            stop_link(stop_link const &) = delete;
+            stop_link &operator=(stop_link const &) = delete;
+            ~stop_link() { detach(); }
+
+            template<typename T>
+            void attach(stop_state &f, T &t) {
+                target = &t;
+                run = [](stop_node &n) {
+                    static_cast<T *>(static_cast<stop_link &>(n).target)
+                            ->request_stop();
+                };
+                from = &f;
+                if (not f.add(*this)) { t.request_stop(); }
+            }
+            /// Attach if the awaiting coroutine is stoppable
+            template<typename P, typename T>
+            void attach(coroutine_handle<P> awaiting, T &t) {
+                if constexpr (is_stoppable_v<P>) {
+                    attach(awaiting.promise().stopping, t);
+                }
+            }
+            void detach() noexcept {
+                if (from) {
+                    from->remove(*this);
+                    from = nullptr;
+                }
+            }
+        };
+
+
+        /// Stop the awaitable if it can be stopped
+        template<typename A>
+        auto request_stop(A &a, int) noexcept
+                -> decltype(void(a.request_stop())) {
+            a.request_stop();
+        }
+        template<typename A>
+        void request_stop(A &, long) noexcept {}
+        template<typename A>
+        void request_stop(A &a) noexcept {
+            request_stop(a, 0);
+        }
+
+
+    }
+
+
+    /// ## This stop token
+    /**
+     * Produces the stop token of the awaiting coroutine, without
+     * suspending it:
+     *
+     * ```cpp
+     * auto const token = co_await f5::makham::this_stop_token();
+     * for (auto &row : rows) {
+     *     if (token.stop_requested()) { co_return {}; }
+     *     // ...
+     * }
+     * ```
+     */
+    class stop_token_awaitable {
+        stop_token token;
+
+      public:
+        bool await_ready() const noexcept { return false; }
+        template<typename P>
+        bool await_suspend(coroutine_handle<P> h) noexcept {
+            static_assert(
+                    is_stoppable_v<P>,
+                    "Only stoppable coroutines have a stop token");
+            token = h.promise().get_stop_token();
+            return false;
+        }
+        stop_token await_resume() const noexcept { return token; }
+    };
+    inline stop_token_awaitable this_stop_token() { return {}; }
+
+
+    /// ## Until stopped
+    /**
+     * Suspends the coroutine until a stop is requested on the token, or
+     * on the coroutine itself if no token is given, and then posts it to
+     * the executor that requests the stop. It is meant for running clean
+     * up, typically by awaiting it in an async alongside the real work in
+     * a `when_any`.
+     */
+    class until_stopped_awaitable {
+        struct resume_coroutine {
+            coroutine_handle<> coro;
+            void operator()() const { post(coro); }
+        };
+        stop_token token;
+        std::optional<stop_callback<resume_coroutine>> waiting;
+        bool own;
+
+      public:
+        until_stopped_awaitable() : own{true} {}
+        explicit until_stopped_awaitable(stop_token t)
+        : token{t}, own{false} {}
+
+        bool await_ready() const noexcept { return token.stop_requested(); }
+        template<typename P>
+        bool await_suspend(coroutine_handle<P> h) {
+            if constexpr (is_stoppable_v<P>) {
+                if (own) { token = h.promise().get_stop_token(); }
+            }
+            if (not token.stop_possible()) {
+                throw std::invalid_argument{
+                        "Nothing can stop this coroutine"};
+            }
+            /// If the stop has already been requested then the callback
+            /// runs straight away and posts the coroutine
+            waiting.emplace(token, resume_coroutine{h});
+            return true;
+        }
+        void await_resume() const noexcept {}
+    };
+    inline until_stopped_awaitable until_stopped() { return {}; }
+    inline until_stopped_awaitable until_stopped(stop_token t) {
+        return until_stopped_awaitable{t};
+    }
+
+
+}
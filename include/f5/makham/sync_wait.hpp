@@ -0,0 +1,222 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/executor.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/trace.hpp>
+
+#include <atomic>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+
+namespace f5::makham {
+
+
+    /// ## Waiting
+    /**
+     * How a thread outside of the executor waits for a coroutine to finish.
+     */
+    enum class waiting {
+        /// Sleep until woken
+        block,
+        /// Run jobs from the executor for as long as there are any, and
+        /// then sleep until woken
+        help
+    };
+
+
+    namespace detail {
+
+
+        /// ### Completion event
+        /**
+         * A one shot event with a single waiting thread, built on one
+         * atomic word. Setting it is a single atomic exchange and only
+         * makes a system call if the waiter has already gone to sleep. A
+         * waiter that turns up after it has been set just reads the word.
+         *
+         * The waiter is free to destroy the event as soon as `wait`
+         * returns.
+         */
+        class sync_event {
+            static constexpr unsigned set_bit = 1, sleeping_bit = 2;
+
+            std::atomic<unsigned> state = {};
+
+            /// Sleep while the state is still `expected`
+            void sleep(unsigned expected);
+            /// Wake the sleeping waiter
+            void wake() noexcept;
+
+          public:
+            bool is_set() const noexcept {
+                return state.load(std::memory_order_acquire) & set_bit;
+            }
+
+            void set() noexcept {
+                if (state.exchange(set_bit, std::memory_order_acq_rel)
+                    & sleeping_bit) {
+                    wake();
+                }
+            }
+
+            void wait(waiting w) {
+                while (w == waiting::help && not is_set() && run_pending()) {}
+                auto s = state.load(std::memory_order_acquire);
+                while (not(s & set_bit)) {
+                    if (s & sleeping_bit
+                        || state.compare_exchange_weak(
+                                s, s | sleeping_bit,
+                                std::memory_order_acquire)) {
+                        sleep(s | sleeping_bit);
+                        s = state.load(std::memory_order_acquire);
+                    }
+                }
+            }
+        };
+
+
+        template<typename T>
+        struct sync_promise;
+
+
+        /// ### Sync task
+        /**
+         * The lazily started coroutine that `sync_wait` runs. Its result is
+         * stored in its own frame.
+         */
+        template<typename T>
+        class sync_task final {
+          public:
+            using promise_type = sync_promise<T>;
+            using handle_type = coroutine_handle<promise_type>;
+
+            /// Not copyable
+            sync_task(sync_task const &) = delete;
+            sync_task &operator=(sync_task const &) = delete;
+            /// Movable
+            sync_task(sync_task &&t) noexcept
+            : coro(std::exchange(t.coro, {})) {}
+            sync_task &operator=(sync_task &&) = delete;
+            ~sync_task() {
+                if (coro) trace::destroy(coro);
+            }
+
+            T run(waiting w) {
+                sync_event done;
+                coro.promise().done = &done;
+                trace::resume(coro);
+                done.wait(w);
+                return coro.promise().get_value();
+            }
+
+          private:
+            friend promise_type;
+            handle_type coro;
+
+            sync_task(handle_type h) : coro{h} {
+                trace::record(trace::event::created, coro);
+            }
+        };
+
+
+        struct sync_final_awaiter {
+            bool await_ready() const noexcept { return false; }
+            template<typename P>
+            void await_suspend(coroutine_handle<P> h) const noexcept {
+                trace::record(trace::event::completed, h);
+                h.promise().done->set();
+            }
+            void await_resume() const noexcept {}
+        };
+
+
+        template<typename T>
+        struct sync_promise final : public pooled_frame {
+            using handle_type = coroutine_handle<sync_promise>;
+
+            sync_event *done = nullptr;
+            std::variant<std::monostate, std::exception_ptr, T> value = {};
+
+            auto get_return_object() {
+                return sync_task<T>{handle_type::from_promise(*this)};
+            }
+            void return_value(T v) { value.template emplace<2>(std::move(v)); }
+            void unhandled_exception() {
+                value.template emplace<1>(std::current_exception());
+            }
+
+            T get_value() {
+                if (value.index() == 1) {
+                    std::rethrow_exception(std::get<1>(value));
+                }
+                return std::move(std::get<2>(value));
+            }
+
+            auto initial_suspend() noexcept { return suspend_always{}; }
+            auto final_suspend() noexcept { return sync_final_awaiter{}; }
+        };
+        template<>
+        struct sync_promise<void> final : public pooled_frame {
+            using handle_type = coroutine_handle<sync_promise>;
+
+            sync_event *done = nullptr;
+            std::exception_ptr eptr = {};
+
+            auto get_return_object() {
+                return sync_task<void>{handle_type::from_promise(*this)};
+            }
+            void return_void() {}
+            void unhandled_exception() { eptr = std::current_exception(); }
+
+            void get_value() {
+                if (eptr) std::rethrow_exception(eptr);
+            }
+
+            auto initial_suspend() noexcept { return suspend_always{}; }
+            auto final_suspend() noexcept { return sync_final_awaiter{}; }
+        };
+
+
+        template<typename T, typename A>
+        sync_task<T> make_sync_task(A &awaitable) {
+            co_return co_await awaitable;
+        }
+
+
+    }
+
+
+    /// ## Sync wait
+    /**
+     * Block the calling thread until the awaitable has completed and then
+     * return its result, or rethrow its exception. This bridges from a
+     * thread outside of the executor, for example `main`, into coroutines
+     * without needing any heap allocated shared state.
+     *
+     * The awaitable is awaited from the calling thread, so a lazy one, like
+     * `task`, starts running on the calling thread until it first suspends.
+     *
+     * Never call this from a coroutine running in the executor as the
+     * thread is lost to the executor until the awaitable completes.
+     */
+    template<typename A>
+    auto sync_wait(A &&awaitable, waiting w = waiting::block) {
+        using result_type =
+                std::decay_t<await_result_t<std::remove_reference_t<A>>>;
+        return detail::make_sync_task<result_type>(awaitable).run(w);
+    }
+
+
+}
@@ -0,0 +1,145 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/async.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/trace.hpp>
+
+#include <exception>
+#include <utility>
+#include <variant>
+
+
+namespace f5::makham {
+
+
+    template<typename T>
+    struct task_promise;
+
+
+    /// ## Task
+    /**
+     * A lazily started coroutine. Unlike `async` nothing is posted to the
+     * executor when a task is created. It starts running only when it is
+     * awaited, inline on the awaiting coroutine's thread, and once done it
+     * resumes the awaiting coroutine through symmetric transfer. This makes
+     * composing small helper coroutines free of any scheduling costs.
+     *
+     * A task must be awaited at most once.
+     */
+    template<typename T>
+    class task final {
+      public:
+        using promise_type = task_promise<T>;
+        using handle_type = coroutine_handle<promise_type>;
+
+        /// Not copyable
+        task(task const &) = delete;
+        task &operator=(task const &) = delete;
+        /// Movable
+        task(task &&t) noexcept : coro(std::exchange(t.coro, {})) {}
+        task &operator=(task &&t) noexcept {
+            if (coro) trace::destroy(coro);
+            coro = std::exchange(t.coro, {});
+            return *this;
+        }
+        ~task() {
+            if (coro) trace::destroy(coro);
+        }
+
+        /// ### Awaitable
+        bool await_ready() const noexcept { return false; }
+        coroutine_handle<> await_suspend(coroutine_handle<> awaiting) {
+            coro.promise().continuation = awaiting;
+            return trace::transfer(awaiting, coro);
+        }
+        T await_resume() { return coro.promise().get_value(); }
+
+      private:
+        friend promise_type;
+        handle_type coro;
+
+        task(handle_type h) : coro{h} {
+            trace::record(trace::event::created, coro);
+        }
+    };
+    template<typename T>
+    struct is_lazy<task<T>> : std::true_type {};
+
+
+    /// Resumes the awaiting coroutine once the task has finished
+    struct task_final_awaiter {
+        bool await_ready() const noexcept { return false; }
+        template<typename P>
+        coroutine_handle<> await_suspend(coroutine_handle<P> h) const noexcept {
+            trace::record(trace::event::completed, h);
+            if (auto c = h.promise().continuation; c) {
+                return trace::transfer(h, c);
+            } else {
+                return noop_coroutine();
+            }
+        }
+        void await_resume() const noexcept {}
+    };
+
+
+    /// ## The task promise type
+    template<typename T>
+    struct task_promise final : public pooled_frame {
+        using handle_type = coroutine_handle<task_promise>;
+
+        coroutine_handle<> continuation = {};
+        std::variant<std::monostate, std::exception_ptr, T> value = {};
+
+        auto get_return_object() {
+            return task<T>{handle_type::from_promise(*this)};
+        }
+        auto initial_suspend() { return suspend_always{}; }
+        auto final_suspend() noexcept { return task_final_awaiter{}; }
+
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { value = std::current_exception(); }
+
+        T get_value() {
+            return apply_visitor(
+                    std::move(value),
+                    [](std::monostate) -> T {
+                        throw std::runtime_error(
+                                "The task doesn't have a value");
+                    },
+                    [](std::exception_ptr e) -> T { std::rethrow_exception(e); },
+                    [](T v) { return v; });
+        }
+    };
+
+    template<>
+    struct task_promise<void> final : public pooled_frame {
+        using handle_type = coroutine_handle<task_promise>;
+
+        coroutine_handle<> continuation = {};
+        std::exception_ptr value = {};
+
+        auto get_return_object() {
+            return task<void>{handle_type::from_promise(*this)};
+        }
+        auto initial_suspend() { return suspend_always{}; }
+        auto final_suspend() noexcept { return task_final_awaiter{}; }
+
+        void return_void() {}
+        void unhandled_exception() { value = std::current_exception(); }
+
+        void get_value() {
+            if (value) std::rethrow_exception(value);
+        }
+    };
+
+
+}
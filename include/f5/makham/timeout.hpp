@@ -0,0 +1,253 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/stop.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/trace.hpp>
+
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+
+namespace f5::makham {
+
+
+    namespace detail {
+
+
+        template<typename T>
+        struct race_promise;
+
+
+        /// ### Race
+        /**
+         * The lazily started coroutine that awaits the awaitable on behalf
+         * of `with_timeout`. Whichever of it and the timer finishes first
+         * wins the race, decided by a single atomic exchange on `state`.
+         * Its frame holds the timer and the result, so it outlives the
+         * awaiter when the timer wins and then destroys itself once the
+         * awaitable finally completes, discarding the late result. It is
+         * stoppable, so an awaited `async` or combinator inherits its stop
+         * requests.
+         */
+        template<typename T>
+        class race final {
+          public:
+            using promise_type = race_promise<T>;
+            using handle_type = coroutine_handle<promise_type>;
+
+            race(race &&r) noexcept : coro{std::exchange(r.coro, {})} {}
+            race(race const &) = delete;
+            race &operator=(race const &) = delete;
+            ~race() {
+                if (coro) trace::destroy(coro);
+            }
+
+            /// Start the timer on the executor and return the coroutine to
+            /// resume to start the race. Nothing in the awaiter may be
+            /// touched after this, as the timer may already have resumed
+            /// the awaiting coroutine
+            coroutine_handle<> start(
+                    executor &e,
+                    coroutine_handle<> awaiting,
+                    timer_clock::time_point deadline) {
+                auto &p = coro.promise();
+                p.owner = &e;
+                p.alarm.deadline = deadline;
+                p.alarm.coro = awaiting;
+                p.alarm.lane = current_priority();
+                handle_type const h = coro;
+                e.start(p.alarm);
+                return h;
+            }
+
+            /// Called when the awaiting coroutine resumes. Returns `false`
+            /// if the timer won, in which case the awaitable is asked to
+            /// stop and the race now owns itself. While the state is still
+            /// racing the frame can't destroy itself, so the stop must be
+            /// requested before the exchange
+            bool finished() {
+                auto &p = coro.promise();
+                if (p.state.load(std::memory_order_acquire)
+                    == promise_type::racing) {
+                    p.request_stop();
+                }
+                auto const s = p.state.exchange(
+                        promise_type::timed_out, std::memory_order_acq_rel);
+                if (s == promise_type::racing) {
+                    coro = {};
+                    return false;
+                } else {
+                    return true;
+                }
+            }
+            T take() {
+                auto &slot = coro.promise().slot;
+                if (slot.index() == 1) {
+                    std::rethrow_exception(std::get<1>(slot));
+                }
+                return std::move(std::get<2>(slot));
+            }
+
+          private:
+            friend promise_type;
+            handle_type coro;
+
+            race(handle_type h) : coro{h} {
+                trace::record(trace::event::created, coro);
+            }
+        };
+
+
+        template<typename T>
+        struct race_promise final : public pooled_frame, public stoppable {
+            using handle_type = coroutine_handle<race_promise>;
+
+            static constexpr int racing = 0, completed = 1, timed_out = 2;
+            std::atomic<int> state = racing;
+            executor *owner = nullptr;
+            timer alarm{{}};
+            std::variant<std::monostate, std::exception_ptr, T> slot = {};
+
+            struct final_awaiter {
+                bool await_ready() const noexcept { return false; }
+                coroutine_handle<>
+                        await_suspend(handle_type h) const noexcept {
+                    trace::record(trace::event::completed, h);
+                    auto &p = h.promise();
+                    if (p.owner->cancel(p.alarm)) {
+                        /// The timer can't fire now, so the awaiting
+                        /// coroutine is ours to resume
+                        p.state.store(completed, std::memory_order_release);
+                        return trace::transfer(h, p.alarm.coro);
+                    }
+                    /// The timer has fired and the awaiting coroutine is
+                    /// on its way. Once the state is set it may destroy
+                    /// this frame, so it can't be touched after that
+                    auto expected = racing;
+                    if (not p.state.compare_exchange_strong(
+                                expected, completed,
+                                std::memory_order_acq_rel)) {
+                        /// Too late. Nobody wants the result
+                        trace::destroy(h);
+                    }
+                    return noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+            };
+
+            auto get_return_object() {
+                return race<T>{handle_type::from_promise(*this)};
+            }
+            auto initial_suspend() noexcept { return suspend_always{}; }
+            auto final_suspend() noexcept { return final_awaiter{}; }
+
+            void return_value(T v) { slot.template emplace<2>(std::move(v)); }
+            void unhandled_exception() {
+                slot.template emplace<1>(std::current_exception());
+            }
+        };
+
+
+        /// Void results are stored as `std::monostate`
+        template<typename A>
+        using race_value_t = std::conditional_t<
+                std::is_void_v<await_result_t<A>>,
+                std::monostate,
+                std::decay_t<await_result_t<A>>>;
+
+        template<typename A>
+        race<race_value_t<A>> run_race(A a) {
+            if constexpr (std::is_void_v<await_result_t<A>>) {
+                co_await a;
+                co_return std::monostate{};
+            } else {
+                co_return co_await a;
+            }
+        }
+
+
+    }
+
+
+    /// ## Timeouts
+    /**
+     * Awaits the awaitable, but for no longer than the deadline:
+     *
+     * ```cpp
+     * if (auto price = co_await f5::makham::with_timeout(quote(), 50ms);
+     *     price) {
+     *     // Use *price
+     * }
+     * ```
+     *
+     * The result is a `std::optional` of the awaitable's result, empty if
+     * the deadline passed first. For awaitables that produce nothing it is
+     * a `bool` that is `true` if the awaitable completed in time. If the
+     * awaitable throws in time the exception is rethrown.
+     *
+     * The awaitable is moved into a coroutine of its own which awaits it.
+     * After a timeout that coroutine is asked to stop, which reaches an
+     * `async` through its stop token (see `stop.hpp`), so work that checks
+     * its token can give up early. The coroutine carries on waiting and
+     * then discards the result, so the awaitable must still complete
+     * eventually.
+     */
+    template<typename A>
+    class timeout_awaitable {
+        using value_type = detail::race_value_t<A>;
+        detail::race<value_type> racer;
+        timer_clock::time_point deadline;
+
+      public:
+        using result_type = std::conditional_t<
+                std::is_void_v<await_result_t<A>>,
+                bool,
+                std::optional<value_type>>;
+
+        timeout_awaitable(A a, timer_clock::time_point d)
+        : racer{detail::run_race(std::move(a))}, deadline{d} {}
+
+        bool await_ready() const noexcept { return false; }
+        coroutine_handle<> await_suspend(coroutine_handle<> awaiting) {
+            return racer.start(current_executor(), awaiting, deadline);
+        }
+        result_type await_resume() {
+            if (not racer.finished()) {
+                return {};
+            } else if constexpr (std::is_void_v<await_result_t<A>>) {
+                racer.take();
+                return true;
+            } else {
+                return racer.take();
+            }
+        }
+    };
+
+    template<typename A>
+    timeout_awaitable<A> with_deadline(A a, timer_clock::time_point tp) {
+        return {std::move(a), tp};
+    }
+    template<typename A, typename Rep, typename Period>
+    timeout_awaitable<A>
+            with_timeout(A a, std::chrono::duration<Rep, Period> d) {
+        return {std::move(a),
+                timer_clock::now()
+                        + std::chrono::ceil<timer_clock::duration>(d)};
+    }
+
+
+}
@@ -0,0 +1,129 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/executor.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+namespace f5::makham {
+
+
+    /// The clock all timers use
+    using timer_clock = std::chrono::steady_clock;
+
+
+    namespace detail {
+        /// Links of the intrusive lists the timer wheel is made from
+        struct timer_links {
+            timer_links *prev = nullptr, *next = nullptr;
+        };
+        class timer_wheel;
+    }
+
+
+    /// ## Timer
+    /**
+     * Resumes a coroutine in an executor once a deadline has passed. The
+     * timer is the node the executor's timer wheel links together, so it
+     * normally lives in the waiting coroutine's frame and starting a timer
+     * never allocates. Millions of them can be pending at once.
+     *
+     * A started timer must not be moved or destroyed until it has either
+     * expired or been cancelled.
+     */
+    class timer : private detail::timer_links {
+        friend class detail::timer_wheel;
+        std::uint64_t tick = {};
+
+      public:
+        timer_clock::time_point deadline;
+        coroutine_handle<> coro = {};
+        priority lane = priority::normal;
+
+        explicit timer(timer_clock::time_point d) : deadline{d} {}
+
+        timer(timer const &) = delete;
+        timer &operator=(timer const &) = delete;
+    };
+
+
+    namespace detail {
+
+
+        /// ### Timer wheel
+        /**
+         * Each executor has one. Its thread only starts when the first
+         * timer does, and is stopped by the executor's destructor. Timers
+         * still pending then never expire.
+         */
+        class timer_wheel {
+            struct impl;
+            std::unique_ptr<impl> pimpl;
+
+          public:
+            timer_wheel(executor &, std::string name);
+            ~timer_wheel();
+
+            void start(timer &);
+            bool cancel(timer &);
+        };
+
+
+    }
+
+
+    /// ## Sleeping
+    /**
+     * Awaitables that suspend the coroutine until a point in time, without
+     * holding up any thread in the meantime:
+     *
+     * ```cpp
+     * co_await f5::makham::sleep_for(250ms);
+     * ```
+     *
+     * The coroutine is resumed as a new job on the executor it was running
+     * on, at its priority. Timers have a resolution of one millisecond and
+     * never expire early, so sleeps are rounded up to a whole millisecond.
+     * Awaiting a time that has already passed doesn't suspend at all.
+     */
+    class sleep_awaitable {
+        timer pending;
+
+      public:
+        explicit sleep_awaitable(timer_clock::time_point d) : pending{d} {}
+
+        bool await_ready() const noexcept {
+            return pending.deadline <= timer_clock::now();
+        }
+        void await_suspend(coroutine_handle<> h) {
+            pending.coro = h;
+            pending.lane = current_priority();
+            current_executor().start(pending);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    inline sleep_awaitable sleep_until(timer_clock::time_point tp) {
+        return sleep_awaitable{tp};
+    }
+    template<typename Rep, typename Period>
+    sleep_awaitable sleep_for(std::chrono::duration<Rep, Period> d) {
+        return sleep_awaitable{
+                timer_clock::now()
+                + std::chrono::ceil<timer_clock::duration>(d)};
+    }
+
+
+}
@@ -0,0 +1,140 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/coroutine.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+
+namespace f5::makham {
+
+
+    /// ## Event tracing
+    /**
+     * Each thread records coroutine life cycle events into its own fixed
+     * size ring buffer. Recording an event is a handful of relaxed stores
+     * with no locks and no allocation, so tracing is cheap enough to be
+     * left on outside of development. Once a thread's ring is full its
+     * oldest events are overwritten.
+     *
+     * The library only records events when it is built with the
+     * `F5_MAKHAM_TRACE` CMake option. Without it `record` compiles to
+     * nothing. Recording can also be paused at run time with `enable`.
+     *
+     * The rings can be read at any time, from any thread, while they are
+     * still being written to. `write_json` dumps them in the Chrome trace
+     * event format, which both `chrome://tracing` and Perfetto load. Each
+     * stretch of time a coroutine runs on a thread is a slice named after
+     * its frame address, and arrows join each post to the resumption it
+     * caused.
+     */
+    namespace trace {
+
+
+        /// Kinds of event
+        enum class event : std::uint8_t {
+            /// The coroutine's frame has been allocated
+            created,
+            /// It has been queued in an executor to be resumed
+            posted,
+            /// It has started running on this thread
+            resumed,
+            /// The thread has stopped running it, or a coroutine it
+            /// transferred to
+            suspended,
+            /// It has reached its final suspend point
+            completed,
+            /// Its frame is about to be freed
+            destroyed
+        };
+
+
+        /// Events kept per thread
+        constexpr std::size_t ring_size = std::size_t{1} << 16;
+
+
+        /// A recorded event
+        struct entry {
+            /// Time since the process started tracing
+            std::chrono::nanoseconds time = {};
+            /// Address of the coroutine's frame
+            void const *frame = nullptr;
+            event what = {};
+            /// The ring that recorded it. Rings of threads that have
+            /// exited are handed on to new threads
+            std::size_t thread = {};
+        };
+
+
+        /// Pause or restart recording in the whole process. On by default
+        void enable(bool) noexcept;
+        bool enabled() noexcept;
+
+        /// Record an event on the calling thread's ring. This works even
+        /// when the library is built without `F5_MAKHAM_TRACE`
+        void emit(event, void const *frame) noexcept;
+
+        /// Every event still in the rings, in time order
+        std::vector<entry> events();
+        /// Forget all of the events recorded so far
+        void clear();
+
+        /// Write the events as a Chrome trace JSON object
+        void write_json(std::ostream &);
+
+
+        /// Record an event for the coroutine when tracing is compiled in
+        inline void record(event e, coroutine_handle<> h) noexcept {
+#ifdef F5_MAKHAM_TRACE
+            emit(e, h.address());
+#else
+            (void)e, (void)h;
+#endif
+        }
+
+        /// Resume the coroutine, recording when it starts and stops
+        /// running on this thread
+        inline void resume(coroutine_handle<> h) {
+            record(event::resumed, h);
+            h.resume();
+            record(event::suspended, h);
+        }
+
+        /// Destroy the coroutine's frame
+        inline void destroy(coroutine_handle<> h) {
+            record(event::destroyed, h);
+            h.destroy();
+        }
+
+        /// Used by `await_suspend` when it symmetrically transfers from
+        /// one coroutine to another. Returns `to`
+        inline coroutine_handle<>
+                transfer(coroutine_handle<> from, coroutine_handle<> to) {
+#ifdef F5_MAKHAM_TRACE
+            if (to.address() != noop_coroutine().address()) {
+                emit(event::suspended, from.address());
+                emit(event::resumed, to.address());
+            }
+#else
+            (void)from;
+#endif
+            return to;
+        }
+
+
+    }
+
+
+}
@@ -11,6 +11,8 @@
 
 #include <f5/makham/async.hpp>
 #include <f5/makham/future.hpp>
+#include <f5/makham/task.hpp>
+#include <f5/makham/when.hpp>
 
 #include <vector>
 
@@ -20,13 +22,18 @@ namespace f5::makham {
 
     /// ## Work unit
     /**
+     * Gathers work and then blocks until all of it is done. Asyncs are
+     * already running when they are added. Tasks are held until `block`,
+     * which starts all of them at once with a single bulk post.
      */
     template<typename R>
     class unit {
         std::vector<async<R>> resumables;
+        std::vector<task<R>> tasks;
 
       public:
         void add(async<R> r) { resumables.push_back(std::move(r)); }
+        void add(task<R> t) { tasks.push_back(std::move(t)); }
         std::size_t block();
     };
 
@@ -37,13 +44,11 @@ namespace f5::makham {
 template<typename R>
 inline std::size_t f5::makham::unit<R>::block() {
     auto const t = [this]() -> async<std::size_t> {
-        /// Wait for them all to finish
-        std::size_t count{};
-        for (auto &t : resumables) {
-            co_await t;
-            ++count;
-        }
-        co_return count;
+        /// The asyncs are already running, so start the tasks first and
+        /// then wait for them all to finish
+        auto const lazies = co_await when_all(std::move(tasks));
+        auto const asyncs = co_await when_all(std::move(resumables));
+        co_return lazies.size() + asyncs.size();
     };
     auto const f = [this](async<std::size_t> a) -> future<std::size_t> {
         co_return co_await a;
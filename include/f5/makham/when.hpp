@@ -0,0 +1,550 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <f5/makham/coroutine.hpp>
+#include <f5/makham/executor.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/stop.hpp>
+#include <f5/makham/trace.hpp>
+
+#include <array>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+
+namespace f5::makham {
+
+
+    /// The value awaiting an `A` produces, with `void` replaced by
+    /// `std::monostate` so that it can be stored
+    template<typename A>
+    using when_result_t = std::conditional_t<
+            std::is_void_v<await_result_t<A>>,
+            std::monostate,
+            std::decay_t<await_result_t<A>>>;
+
+
+    namespace detail {
+
+
+        /// Where the result of one of the joined awaitables ends up
+        template<typename T>
+        using join_slot = std::variant<std::monostate, std::exception_ptr, T>;
+
+        template<typename T>
+        T take(join_slot<T> &slot) {
+            if (slot.index() == 1) {
+                std::rethrow_exception(std::get<1>(slot));
+            }
+            return std::move(std::get<2>(slot));
+        }
+
+
+        template<typename J>
+        struct join_promise;
+
+
+        /// ### Join task
+        /**
+         * A lazily started coroutine that awaits one of the awaitables being
+         * joined and then reports its arrival to the join `J`. `J::arrived`
+         * returns the coroutine that is to run next.
+         */
+        template<typename J>
+        class join_task final {
+          public:
+            using promise_type = join_promise<J>;
+            using handle_type = coroutine_handle<promise_type>;
+
+            join_task() = default;
+            /// Not copyable
+            join_task(join_task const &) = delete;
+            join_task &operator=(join_task const &) = delete;
+            /// Movable
+            join_task(join_task &&t) noexcept
+            : parallel{t.parallel}, coro(std::exchange(t.coro, {})) {}
+            join_task &operator=(join_task &&t) noexcept {
+                if (coro) trace::destroy(coro);
+                coro = std::exchange(t.coro, {});
+                parallel = t.parallel;
+                return *this;
+            }
+            ~join_task() {
+                if (coro) trace::destroy(coro);
+            }
+
+            /// Empty if the awaitable was already complete
+            explicit operator bool() const noexcept { return bool(coro); }
+
+            /// Get ready to start, returning the coroutine to resume
+            coroutine_handle<> prepare(J &join, std::size_t index) {
+                coro.promise().join = &join;
+                coro.promise().index = index;
+                return coro;
+            }
+            void start(J &join, std::size_t index) {
+                trace::resume(prepare(join, index));
+            }
+
+            /// Start on the executor rather than on the awaiting thread
+            bool parallel = false;
+
+          private:
+            friend promise_type;
+            handle_type coro = {};
+
+            join_task(handle_type h) : coro{h} {
+                trace::record(trace::event::created, coro);
+            }
+        };
+
+
+        template<typename J>
+        struct join_promise final : public pooled_frame {
+            J *join = nullptr;
+            std::size_t index = {};
+
+            struct final_awaiter {
+                bool await_ready() const noexcept { return false; }
+                coroutine_handle<> await_suspend(
+                        coroutine_handle<join_promise> h) const noexcept {
+                    /// The join may destroy this frame, so nothing in it
+                    /// can be touched after arriving
+                    trace::record(trace::event::completed, h);
+                    auto &p = h.promise();
+                    return trace::transfer(h, p.join->arrived(p.index));
+                }
+                void await_resume() const noexcept {}
+            };
+
+            auto get_return_object() {
+                return join_task<J>{
+                        join_task<J>::handle_type::from_promise(*this)};
+            }
+            auto initial_suspend() noexcept { return suspend_always{}; }
+            auto final_suspend() noexcept { return final_awaiter{}; }
+            void return_void() {}
+            /// `join_one` catches everything itself
+            void unhandled_exception() { std::terminate(); }
+        };
+
+
+        /// Put whatever the ready awaitable `a` produces into `slot`
+        template<typename A, typename T>
+        void store(A &a, join_slot<T> &slot) noexcept {
+            try {
+                if constexpr (std::is_void_v<decltype(a.await_resume())>) {
+                    a.await_resume();
+                    slot.template emplace<2>();
+                } else {
+                    slot.template emplace<2>(a.await_resume());
+                }
+            } catch (...) {
+                slot.template emplace<1>(std::current_exception());
+            }
+        }
+
+        /// Await `a` and put whatever it produces into `slot`
+        template<typename J, typename A, typename T>
+        join_task<J> join_one(A &a, join_slot<T> &slot) {
+            try {
+                if constexpr (std::is_void_v<await_result_t<A>>) {
+                    co_await a;
+                    slot.template emplace<2>();
+                } else {
+                    slot.template emplace<2>(co_await a);
+                }
+            } catch (...) {
+                slot.template emplace<1>(std::current_exception());
+            }
+        }
+        /// Only awaitables that aren't ready yet need a join task
+        template<typename J, typename A, typename T>
+        join_task<J> join(A &a, join_slot<T> &slot) {
+            if constexpr (std::is_same_v<awaiter_t<A>, A &>) {
+                if (a.await_ready()) {
+                    store(a, slot);
+                    return {};
+                }
+            }
+            auto t = join_one<J>(a, slot);
+            t.parallel = is_lazy_v<A>;
+            return t;
+        }
+
+
+        /// Start all of the join tasks, calling `ready` with the index of
+        /// each awaitable that was already complete. The lazy ones go to
+        /// the executor in a single bulk post, unless there is only one
+        template<typename J, typename Tasks, typename Ready>
+        void start_all(J &join, Tasks &tasks, Ready ready) {
+            std::vector<coroutine_handle<>> parallel;
+            std::size_t index{};
+            for (auto &t : tasks) {
+                if (not t) {
+                    ready(index);
+                } else if (t.parallel) {
+                    parallel.push_back(t.prepare(join, index));
+                } else {
+                    t.start(join, index);
+                }
+                ++index;
+            }
+            if (parallel.size() == 1) {
+                trace::resume(parallel.front());
+            } else if (not parallel.empty()) {
+                post_bulk(parallel);
+            }
+        }
+
+
+        /// ### Joined awaitables
+        /**
+         * Storage for a fixed number of awaitables of any type, and for a
+         * run time number of awaitables of the same type.
+         */
+        template<typename... A>
+        struct join_tuple {
+            using all_type = std::tuple<when_result_t<A>...>;
+            using any_type = std::variant<when_result_t<A>...>;
+            template<typename J>
+            using tasks_type = std::array<join_task<J>, sizeof...(A)>;
+
+            std::tuple<A...> awaitables;
+            std::tuple<join_slot<when_result_t<A>>...> slots = {};
+
+            join_tuple(A... a) : awaitables{std::move(a)...} {}
+
+            std::size_t size() const noexcept { return sizeof...(A); }
+
+            template<typename J>
+            tasks_type<J> tasks() {
+                return tasks<J>(std::index_sequence_for<A...>{});
+            }
+            all_type all() {
+                return std::apply(
+                        [](auto &... s) { return all_type{take(s)...}; },
+                        slots);
+            }
+            any_type one(std::size_t index) {
+                return one(index, std::index_sequence_for<A...>{});
+            }
+            void request_stop() noexcept {
+                std::apply(
+                        [](auto &... a) { (detail::request_stop(a), ...); },
+                        awaitables);
+            }
+
+          private:
+            template<typename J, std::size_t... I>
+            tasks_type<J> tasks(std::index_sequence<I...>) {
+                return {join<J>(
+                        std::get<I>(awaitables), std::get<I>(slots))...};
+            }
+            template<std::size_t... I>
+            any_type one(std::size_t index, std::index_sequence<I...>) {
+                std::optional<any_type> result;
+                ((I == index ? (void)result.emplace(
+                         std::in_place_index<I>, take(std::get<I>(slots)))
+                             : void()),
+                 ...);
+                return std::move(*result);
+            }
+        };
+
+        template<typename A>
+        struct join_vector {
+            using all_type = std::vector<when_result_t<A>>;
+            using any_type = std::pair<std::size_t, when_result_t<A>>;
+            template<typename J>
+            using tasks_type = std::vector<join_task<J>>;
+
+            std::vector<A> awaitables;
+            std::vector<join_slot<when_result_t<A>>> slots;
+
+            join_vector(std::vector<A> a)
+            : awaitables{std::move(a)}, slots(awaitables.size()) {}
+
+            std::size_t size() const noexcept { return awaitables.size(); }
+
+            template<typename J>
+            tasks_type<J> tasks() {
+                tasks_type<J> t;
+                t.reserve(awaitables.size());
+                for (std::size_t i{}; i < awaitables.size(); ++i) {
+                    t.push_back(join<J>(awaitables[i], slots[i]));
+                }
+                return t;
+            }
+            all_type all() {
+                all_type results;
+                results.reserve(slots.size());
+                for (auto &s : slots) { results.push_back(take(s)); }
+                return results;
+            }
+            any_type one(std::size_t index) {
+                return {index, take(slots[index])};
+            }
+            void request_stop() noexcept {
+                for (auto &a : awaitables) { detail::request_stop(a); }
+            }
+        };
+
+
+        /// ### Join counter
+        /**
+         * A single countdown shared by all of the joined awaitables and the
+         * awaiting coroutine, which counts itself once it has started them
+         * all. Whoever brings it to zero resumes the awaiting coroutine, so
+         * it is resumed exactly once no matter how the joined awaitables
+         * race each other.
+         */
+        class join_counter {
+            std::atomic<std::size_t> count;
+            coroutine_handle<> awaiting = {};
+
+          public:
+            join_counter(std::size_t n) : count{n + 1} {}
+
+            /// Returns `true` if the awaiting coroutine is to stay suspended
+            template<typename Tasks>
+            bool suspend(coroutine_handle<> h, Tasks &tasks) {
+                awaiting = h;
+                std::size_t ready{1};
+                start_all(*this, tasks, [&](std::size_t) { ++ready; });
+                return count.fetch_sub(ready, std::memory_order_acq_rel)
+                        != ready;
+            }
+
+            coroutine_handle<> arrived(std::size_t) noexcept {
+                if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    return awaiting;
+                } else {
+                    return noop_coroutine();
+                }
+            }
+        };
+
+
+        /// ### Join winner
+        /**
+         * The first awaitable to arrive wins. The awaiting coroutine resumes
+         * once the winner has arrived and it has started all the others,
+         * whichever happens last. The losers are asked to stop, but carry
+         * on running until they notice, so this lives until the last of
+         * them, and the awaiting coroutine, are done with it.
+         */
+        class join_winner {
+            static constexpr std::size_t none =
+                    std::numeric_limits<std::size_t>::max();
+
+            std::atomic<std::size_t> references;
+            std::atomic<std::size_t> first = none;
+            std::atomic<unsigned> count = 2;
+            coroutine_handle<> awaiting = {};
+
+          public:
+            join_winner(std::size_t n) : references{n + 1} {}
+            virtual ~join_winner() = default;
+
+            /// Stop all of the awaitables that can be stopped
+            virtual void request_stop() noexcept = 0;
+
+            /// Returns `true` if the awaiting coroutine is to stay suspended
+            template<typename Tasks>
+            bool suspend(coroutine_handle<> h, Tasks &tasks) {
+                awaiting = h;
+                /// Arriving can't resume us as we haven't counted ourself yet
+                start_all(*this, tasks, [this](std::size_t index) {
+                    arrived(index);
+                });
+                return count.fetch_sub(1, std::memory_order_acq_rel) != 1;
+            }
+            std::size_t winner() const noexcept {
+                return first.load(std::memory_order_acquire);
+            }
+
+            coroutine_handle<> arrived(std::size_t index) noexcept {
+                coroutine_handle<> next = noop_coroutine();
+                auto expected = none;
+                if (first.compare_exchange_strong(
+                            expected, index, std::memory_order_acq_rel)) {
+                    request_stop();
+                    if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        next = awaiting;
+                    }
+                }
+                release();
+                return next;
+            }
+            void release() noexcept {
+                if (references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    delete this;
+                }
+            }
+        };
+
+        template<typename S>
+        struct any_state final : public join_winner {
+            S joined;
+            typename S::template tasks_type<join_winner> tasks = {};
+
+            any_state(S s) : join_winner{s.size()}, joined{std::move(s)} {}
+
+            void request_stop() noexcept override { joined.request_stop(); }
+        };
+
+
+    }
+
+
+    /// ## When all
+    /**
+     * Awaits all of the awaitables and then produces all of their results.
+     * The awaiting coroutine is resumed only once, by whichever awaitable
+     * completes last. If any of them throws then the first exception, in
+     * argument order, is rethrown once all have completed.
+     *
+     * Lazy awaitables, like `task`, are started in parallel on the
+     * executor using a single `post_bulk`, so a large fan out of them
+     * costs one atomic operation per worker to schedule.
+     *
+     * A stop requested on the awaiting coroutine is passed on to all of
+     * the awaitables that can be stopped.
+     *
+     * ```cpp
+     * auto [a, b] = co_await when_all(fetch(x), fetch(y));
+     * ```
+     */
+    template<typename S>
+    class when_all_awaitable final : private detail::join_counter {
+        S joined;
+        typename S::template tasks_type<detail::join_counter> tasks = {};
+        detail::stop_link parent;
+
+      public:
+        when_all_awaitable(S s)
+        : join_counter{s.size()}, joined{std::move(s)} {}
+
+        bool await_ready() const noexcept { return joined.size() == 0; }
+        template<typename P>
+        bool await_suspend(coroutine_handle<P> awaiting) {
+            parent.attach(awaiting, joined);
+            tasks = joined.template tasks<detail::join_counter>();
+            if (suspend(awaiting, tasks)) {
+                return true;
+            } else {
+                parent.detach();
+                return false;
+            }
+        }
+        typename S::all_type await_resume() {
+            parent.detach();
+            return joined.all();
+        }
+    };
+
+    /// Produces a `std::tuple` of the results
+    template<typename... A>
+    auto when_all(A... a) {
+        return when_all_awaitable<detail::join_tuple<A...>>{
+                detail::join_tuple<A...>{std::move(a)...}};
+    }
+    /// Produces a `std::vector` of the results
+    template<typename A>
+    auto when_all(std::vector<A> a) {
+        return when_all_awaitable<detail::join_vector<A>>{
+                detail::join_vector<A>{std::move(a)}};
+    }
+
+
+    /// ## When any
+    /**
+     * Awaits the first of the awaitables to complete, and produces its
+     * result. The others are asked to stop, if they can be, and are left
+     * to run to completion with their results discarded. A stop requested
+     * on the awaiting coroutine is passed on to all of them.
+     */
+    template<typename S>
+    class when_any_awaitable final {
+        detail::any_state<S> *state;
+        bool started = false;
+        detail::stop_link parent;
+
+      public:
+        when_any_awaitable(S s)
+        : state{new detail::any_state<S>{std::move(s)}} {
+            if (state->joined.size() == 0) {
+                delete state;
+                throw std::invalid_argument{
+                        "when_any needs at least one awaitable"};
+            }
+        }
+        /// Not copyable
+        when_any_awaitable(when_any_awaitable const &) = delete;
+        when_any_awaitable &operator=(when_any_awaitable const &) = delete;
+        /// Movable
+        when_any_awaitable(when_any_awaitable &&w) noexcept
+        : state{std::exchange(w.state, nullptr)},
+          started{std::exchange(w.started, false)} {}
+        when_any_awaitable &operator=(when_any_awaitable &&) = delete;
+        ~when_any_awaitable() {
+            parent.detach();
+            if (state && started) {
+                state->release();
+            } else {
+                delete state;
+            }
+        }
+
+        bool await_ready() const noexcept { return false; }
+        template<typename P>
+        bool await_suspend(coroutine_handle<P> awaiting) {
+            parent.attach(awaiting, *state);
+            state->tasks = state->joined.template tasks<detail::join_winner>();
+            started = true;
+            if (state->suspend(awaiting, state->tasks)) {
+                return true;
+            } else {
+                parent.detach();
+                return false;
+            }
+        }
+        typename S::any_type await_resume() {
+            parent.detach();
+            return state->joined.one(state->winner());
+        }
+    };
+
+    /// Produces a `std::variant` holding the winner's result, whose `index`
+    /// is the winner's position
+    template<typename... A>
+    auto when_any(A... a) {
+        return when_any_awaitable<detail::join_tuple<A...>>{
+                detail::join_tuple<A...>{std::move(a)...}};
+    }
+    /// Produces the winner's position and its result
+    template<typename A>
+    auto when_any(std::vector<A> a) {
+        return when_any_awaitable<detail::join_vector<A>>{
+                detail::join_vector<A>{std::move(a)}};
+    }
+
+
+}
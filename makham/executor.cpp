@@ -7,13 +7,331 @@
 
 
 #include <f5/makham/executor.hpp>
+#include <f5/makham/file.hpp>
+#include <f5/makham/frame_pool.hpp>
+#include <f5/makham/io.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/trace.hpp>
 
+#include <thread-pool/mpmc_bounded_queue.hpp>
 #include <thread-pool/thread_pool.hpp>
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+
+namespace {
+
+
+    /// Priority of the job running on this thread
+    thread_local f5::makham::priority t_priority =
+            f5::makham::priority::normal;
+
+
+    class job;
+    using pool_type = tp::ThreadPoolImpl<job, tp::MPMCBoundedQueue>;
+
+
+    /// A coroutine post that is timed until it resumes, for the latency
+    /// histograms. Taken from the frame pool so that it doesn't allocate
+    struct timed_resume {
+        f5::makham::coroutine_handle<> coro;
+        std::chrono::steady_clock::time_point posted;
+        pool_type *pool;
+
+        static timed_resume *
+                make(f5::makham::coroutine_handle<> h, pool_type &p) {
+            return new (f5::makham::frame_pool::allocate(sizeof(timed_resume)))
+                    timed_resume{h, std::chrono::steady_clock::now(), &p};
+        }
+        static void free(timed_resume *t) noexcept {
+            t->~timed_resume();
+            f5::makham::frame_pool::deallocate(t);
+        }
+    };
+
+
+    /// ## Job
+    /**
+     * A single word in the thread pool's queues. Nearly every job resumes
+     * a coroutine, so the word is just the frame address. Functions are
+     * rare and are moved to the heap, with the low bit of the word set to
+     * tell them apart. The next bit records the job's priority, and the
+     * one after that marks a timed resume. Frames, heap blocks and frame
+     * pool blocks are all aligned to at least eight bytes so the bits are
+     * always free.
+     */
+    class job {
+        static constexpr std::uintptr_t function_bit = 1, high_bit = 2,
+                                        timed_bit = 4,
+                                        tag_bits =
+                                                function_bit | high_bit
+                                                | timed_bit;
+        std::uintptr_t word = {};
+
+        static std::uintptr_t tag(f5::makham::priority p) {
+            return p == f5::makham::priority::high ? high_bit : 0;
+        }
+        void reset() noexcept {
+            if (word & function_bit) {
+                delete reinterpret_cast<f5::makham::function_type *>(
+                        word & ~tag_bits);
+            } else if (word & timed_bit) {
+                timed_resume::free(
+                        reinterpret_cast<timed_resume *>(word & ~tag_bits));
+            }
+            word = {};
+        }
+
+      public:
+        job() noexcept = default;
+        job(f5::makham::coroutine_handle<> h, f5::makham::priority p) noexcept
+        : word{reinterpret_cast<std::uintptr_t>(h.address()) | tag(p)} {}
+        job(f5::makham::function_type f, f5::makham::priority p)
+        : word{reinterpret_cast<std::uintptr_t>(
+                       new f5::makham::function_type{std::move(f)})
+               | function_bit | tag(p)} {}
+        job(timed_resume *t, f5::makham::priority p) noexcept
+        : word{reinterpret_cast<std::uintptr_t>(t) | timed_bit | tag(p)} {}
+
+        job(job &&j) noexcept : word{std::exchange(j.word, {})} {}
+        job &operator=(job &&j) noexcept {
+            reset();
+            word = std::exchange(j.word, {});
+            return *this;
+        }
+        ~job() { reset(); }
+
+        void operator()() {
+            auto const w = std::exchange(word, {});
+            /// Anything posted while the job runs inherits its priority
+            struct inherit {
+                f5::makham::priority outer;
+                ~inherit() { t_priority = outer; }
+            } const restore{std::exchange(
+                    t_priority,
+                    w & high_bit ? f5::makham::priority::high
+                                 : f5::makham::priority::normal)};
+            if (w & function_bit) {
+                std::unique_ptr<f5::makham::function_type> f{
+                        reinterpret_cast<f5::makham::function_type *>(
+                                w & ~tag_bits)};
+                (*f)();
+            } else if (w & timed_bit) {
+                auto *const t = reinterpret_cast<timed_resume *>(w & ~tag_bits);
+                auto const coro = t->coro;
+                t->pool->recordLatency(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - t->posted)
+                                .count());
+                timed_resume::free(t);
+                f5::makham::trace::resume(coro);
+            } else {
+                f5::makham::trace::resume(
+                        f5::makham::coroutine_handle<>::from_address(
+                                reinterpret_cast<void *>(w & ~tag_bits)));
+            }
+        }
+    };
+    static_assert(sizeof(job) == sizeof(void *));
+
+
+    thread_local f5::makham::executor *t_current = nullptr;
+
+
+    /// Options for the default executor and whether it exists yet
+    struct defaults_type {
+        std::mutex mutex;
+        f5::makham::executor::options options;
+        bool created = false;
+    };
+    defaults_type &defaults() {
+        static defaults_type d;
+        return d;
+    }
+
+
+}
+
+
+struct f5::makham::executor::impl {
+    std::size_t const latency_sampling;
+    pool_type threads;
+    /// Declared after the threads so they stop before they do
+    detail::timer_wheel timers;
+    detail::reactor io;
+    detail::io_ring ring;
+
+    /// True for the posts that are to be timed
+    bool sample() const noexcept {
+        thread_local std::size_t posts = {};
+        return latency_sampling && ++posts % latency_sampling == 0;
+    }
+
+    static tp::ThreadPoolOptions pool_options(executor *e, options o) {
+        tp::ThreadPoolOptions p;
+        if (o.threads) { p.setThreadCount(o.threads); }
+        p.setQueueSize(o.queue_size);
+        p.setStarvationLimit(o.starvation_limit);
+        p.setNodes(std::move(o.nodes));
+        p.setThreadStart([e, name = std::move(o.name)](std::size_t id) {
+            t_current = e;
+#ifdef __linux__
+            /// Linux limits thread names to 15 characters
+            auto const full = name + "-" + std::to_string(id);
+            ::pthread_setname_np(
+                    ::pthread_self(), full.substr(0, 15).c_str());
+#endif
+        });
+        return p;
+    }
+
+    impl(executor *e, options o)
+    : latency_sampling{o.latency_sampling},
+      threads{pool_options(e, o)},
+      timers{*e, o.name + "-timer"},
+      io{*e, o.name + "-io"},
+      ring{*e, o.name + "-ring", o.io_uring} {}
+};
+
+
+f5::makham::executor::executor() : executor{options{}} {}
+f5::makham::executor::executor(options o)
+: pimpl{std::make_unique<impl>(this, std::move(o))} {}
+f5::makham::executor::~executor() = default;
+
 
 namespace {
-    tp::ThreadPool threads;
+    tp::Priority lane(f5::makham::priority p) {
+        return p == f5::makham::priority::high ? tp::Priority::High
+                                               : tp::Priority::Normal;
+    }
+}
+
+
+void f5::makham::executor::post(function_type f, priority p) {
+    pimpl->threads.post(job{std::move(f), p}, lane(p));
+}
+
+
+void f5::makham::executor::post(coroutine_handle<> coro, priority p) {
+    if (coro) { trace::record(trace::event::posted, coro); }
+    if (coro && pimpl->sample()) {
+        pimpl->threads.post(
+                job{timed_resume::make(coro, pimpl->threads), p}, lane(p));
+    } else if (coro) {
+        pimpl->threads.post(job{coro, p}, lane(p));
+    }
 }
 
 
-void f5::makham::post(function_type f) { threads.post(std::move(f)); }
+void f5::makham::executor::post_bulk(
+        coroutine_handle<> const *handles, std::size_t count, priority p) {
+    for (std::size_t i{}; i < count; ++i) {
+        trace::record(trace::event::posted, handles[i]);
+    }
+    pimpl->threads.postBulk(
+            count, [&](std::size_t i) { return job{handles[i], p}; },
+            lane(p));
+}
+
+
+void f5::makham::executor::start(timer &t) { pimpl->timers.start(t); }
+bool f5::makham::executor::cancel(timer &t) {
+    return pimpl->timers.cancel(t);
+}
+
+
+void f5::makham::executor::watch(detail::io_handle &h) { pimpl->io.add(h); }
+void f5::makham::executor::unwatch(std::unique_ptr<detail::io_handle> h) {
+    pimpl->io.remove(std::move(h));
+}
+
+
+void f5::makham::executor::submit(detail::ring_op &op) {
+    pimpl->ring.submit(op);
+}
+bool f5::makham::executor::uses_io_uring() const noexcept {
+    return pimpl->ring.uses_io_uring();
+}
+
+
+bool f5::makham::executor::run_pending() {
+    return pimpl->threads.tryRunPending();
+}
+
+
+std::size_t f5::makham::executor::overflow_count() const {
+    return pimpl->threads.overflowCount();
+}
+
+
+auto f5::makham::current_priority() noexcept -> priority {
+    return t_priority;
+}
+
+
+auto f5::makham::executor::metrics() const -> std::vector<worker_metrics> {
+    std::vector<worker_metrics> all;
+    for (auto const &w : pimpl->threads.metrics()) {
+        worker_metrics m;
+        m.executed = w.executed;
+        m.steal_attempts = w.stealAttempts;
+        m.steals = w.steals;
+        m.parks = w.parks;
+        m.idle = std::chrono::nanoseconds{w.idleNanos};
+        m.queue_depth = w.queueDepth;
+        m.overflowed = w.overflowed;
+        for (std::size_t i{}; i < m.latency.size(); ++i) {
+            m.latency[i] = w.latency[i];
+        }
+        all.push_back(m);
+    }
+    return all;
+}
+
+
+auto f5::makham::executor::current() noexcept -> executor * {
+    return t_current;
+}
+
+
+f5::makham::use_executor::use_executor(executor &e)
+: outer{std::exchange(t_current, &e)} {}
+f5::makham::use_executor::~use_executor() { t_current = outer; }
+
+
+auto f5::makham::default_executor() -> executor & {
+    static executor e{[]() {
+        auto &d = defaults();
+        std::lock_guard<std::mutex> lock{d.mutex};
+        d.created = true;
+        return d.options;
+    }()};
+    return e;
+}
+
+
+void f5::makham::configure_default_executor(executor::options o) {
+    auto &d = defaults();
+    std::lock_guard<std::mutex> lock{d.mutex};
+    if (d.created) {
+        throw std::logic_error{
+                "The default executor has already been created"};
+    }
+    d.options = std::move(o);
+}
+
+
+auto f5::makham::numa_nodes() -> std::vector<std::vector<std::size_t>> {
+    return tp::ThreadPoolOptions::systemNodes();
+}
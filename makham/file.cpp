@@ -0,0 +1,439 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/file.hpp>
+
+#include <array>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#if __has_include(<linux/io_uring.h>)
+#define F5_MAKHAM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+namespace {
+
+
+    [[noreturn]] void fail(char const *what) {
+        throw std::system_error{errno, std::system_category(), what};
+    }
+
+
+    /// Threads running the operations when there is no io_uring
+    constexpr std::size_t blocking_threads = 4;
+    /// Length of the io_uring's submission queue. Its completion queue is
+    /// twice as long, and that many operations can be running at once
+    constexpr unsigned ring_entries = 256;
+
+
+#ifdef F5_MAKHAM_IO_URING
+    /// ### io_uring
+    /**
+     * The kernel's submission and completion queues, mapped into the
+     * process. Only the I/O ring's thread uses them, so the queue indexes
+     * it owns need no more than ordinary loads and stores, and those the
+     * kernel moves are read with acquire and written with release.
+     */
+    class uring {
+        int const fd;
+        ::io_uring_params params;
+        void *queues = MAP_FAILED;
+        std::size_t queues_size = {};
+        ::io_uring_sqe *entries = static_cast<::io_uring_sqe *>(MAP_FAILED);
+
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        ::io_uring_cqe *cqes;
+        /// Entries filled in but not yet seen by the kernel end here
+        unsigned tail = {};
+
+        uring(int f, ::io_uring_params const &p) : fd{f}, params{p} {}
+
+        template<typename T>
+        T *at(std::uint32_t offset) const {
+            return reinterpret_cast<T *>(
+                    static_cast<char *>(queues) + offset);
+        }
+
+      public:
+        /// Returns null if the kernel can't provide one we can use
+        static std::unique_ptr<uring> create(unsigned size) {
+            ::io_uring_params p{};
+            int const f = ::syscall(__NR_io_uring_setup, size, &p);
+            if (f < 0) { return {}; }
+            std::unique_ptr<uring> r{new uring{f, p}};
+            /// One shared mapping for both queues, no dropped completions
+            /// and reads of an eventfd all came in by Linux 5.6
+            auto const needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+                    | IORING_FEAT_RW_CUR_POS;
+            if ((p.features & needed) != needed) { return {}; }
+            r->queues_size = std::max(
+                    p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                    p.cq_off.cqes + p.cq_entries * sizeof(::io_uring_cqe));
+            r->queues = ::mmap(
+                    nullptr, r->queues_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, f, IORING_OFF_SQ_RING);
+            if (r->queues == MAP_FAILED) { return {}; }
+            r->entries = static_cast<::io_uring_sqe *>(::mmap(
+                    nullptr, p.sq_entries * sizeof(::io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f,
+                    IORING_OFF_SQES));
+            if (r->entries == MAP_FAILED) { return {}; }
+            r->sq_head = r->at<unsigned>(p.sq_off.head);
+            r->sq_tail = r->at<unsigned>(p.sq_off.tail);
+            r->sq_mask = r->at<unsigned>(p.sq_off.ring_mask);
+            r->sq_array = r->at<unsigned>(p.sq_off.array);
+            r->cq_head = r->at<unsigned>(p.cq_off.head);
+            r->cq_tail = r->at<unsigned>(p.cq_off.tail);
+            r->cq_mask = r->at<unsigned>(p.cq_off.ring_mask);
+            r->cqes = r->at<::io_uring_cqe>(p.cq_off.cqes);
+            r->tail = *r->sq_tail;
+            return r;
+        }
+        ~uring() {
+            if (entries != MAP_FAILED) {
+                ::munmap(entries, params.sq_entries * sizeof(::io_uring_sqe));
+            }
+            if (queues != MAP_FAILED) { ::munmap(queues, queues_size); }
+            ::close(fd);
+        }
+
+        /// The most operations that can be running at once without the
+        /// kernel having to hold completions back
+        unsigned capacity() const noexcept { return params.cq_entries; }
+
+        /// The next free submission entry, cleared, or null if the queue
+        /// is full. It is only seen by the kernel on the next `enter`
+        ::io_uring_sqe *next() noexcept {
+            if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)
+                == params.sq_entries) {
+                return nullptr;
+            }
+            auto const index = tail++ & *sq_mask;
+            sq_array[index] = index;
+            entries[index] = {};
+            return &entries[index];
+        }
+
+        /// Hand the kernel everything queued since the last call, and
+        /// wait until there is at least one completion if asked to.
+        /// Returns the negated `errno` on failure, in which case whatever
+        /// the kernel didn't take stays queued for the next call
+        int enter(bool wait) noexcept {
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+            auto const queued =
+                    tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            auto const r = ::syscall(
+                    __NR_io_uring_enter, fd, queued, wait ? 1u : 0u,
+                    wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+            return r < 0 ? -errno : static_cast<int>(r);
+        }
+
+        /// Call the function with each completion so far
+        template<typename F>
+        void reap(F f) {
+            auto head = *cq_head;
+            auto const tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) { f(cqes[head & *cq_mask]); }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+    };
+#endif
+
+
+    void run_blocking(f5::makham::detail::ring_op &op) {
+        using kind = f5::makham::detail::ring_op::kind;
+        ::ssize_t done;
+        do {
+            if (op.what == kind::read) {
+                done = ::pread(op.fd, op.buffer, op.size, op.offset);
+            } else {
+                done = ::pwrite(op.fd, op.buffer, op.size, op.offset);
+            }
+        } while (done < 0 && errno == EINTR);
+        op.result = done < 0 ? -errno : static_cast<int>(done);
+    }
+
+
+}
+
+
+/// ### I/O ring
+/**
+ * Submitting an operation queues it under the mutex. The ring's thread
+ * takes the whole queue in one go, fills in a submission entry for each
+ * with the operation's address as its user data, and then makes a single
+ * `io_uring_enter` that both submits them and waits for a completion. A
+ * read of an eventfd is always outstanding as well, so that anything
+ * submitted while the thread waits can wake it. Only the first
+ * submission after the thread has taken the queue writes to the eventfd,
+ * so a burst of them costs one extra system call between them.
+ *
+ * Operations beyond the capacity of the completion queue wait their turn
+ * in a backlog.
+ *
+ * Without an io_uring the same queue feeds a few blocking threads instead.
+ */
+struct f5::makham::detail::io_ring::impl {
+    executor &owner;
+    std::string const name;
+#ifdef F5_MAKHAM_IO_URING
+    std::unique_ptr<uring> ring;
+    int wake = -1;
+    std::uint64_t wakes = {};
+#endif
+
+    std::mutex mutex;
+    std::condition_variable signalled;
+    std::vector<std::thread> threads;
+    std::deque<ring_op *> queued;
+    /// Set when the ring's thread has taken the queue, so the next
+    /// submission knows to wake it
+    bool waiting = false;
+    bool stopping = false;
+
+    impl(executor &e, std::string n, bool u) : owner{e}, name{std::move(n)} {
+#ifdef F5_MAKHAM_IO_URING
+        if (u) {
+            wake = ::eventfd(0, EFD_CLOEXEC);
+            if (wake < 0) { fail("eventfd"); }
+            ring = uring::create(ring_entries);
+        }
+#else
+        static_cast<void>(u);
+#endif
+    }
+    ~impl() {
+#ifdef F5_MAKHAM_IO_URING
+        ring.reset();
+        if (wake >= 0) { ::close(wake); }
+#endif
+    }
+
+    bool uses_io_uring() const noexcept {
+#ifdef F5_MAKHAM_IO_URING
+        return bool(ring);
+#else
+        return false;
+#endif
+    }
+
+    void signal() {
+#ifdef F5_MAKHAM_IO_URING
+        if (ring) {
+            std::uint64_t const one = 1;
+            [[maybe_unused]] auto const w = ::write(wake, &one, sizeof(one));
+            return;
+        }
+#endif
+        signalled.notify_all();
+    }
+
+    void name_thread([[maybe_unused]] std::size_t index) {
+#ifdef __linux__
+        auto const full = uses_io_uring() ? name
+                                          : name + "-" + std::to_string(index);
+        ::pthread_setname_np(::pthread_self(), full.substr(0, 15).c_str());
+#endif
+    }
+
+    /// Called with the mutex held
+    void start() {
+        if (uses_io_uring()) {
+            threads.emplace_back([this]() { run_ring(); });
+        } else {
+            for (std::size_t i{}; i < blocking_threads; ++i) {
+                threads.emplace_back([this, i]() { run_blocking_thread(i); });
+            }
+        }
+    }
+
+    /// The operation can complete and its coroutine carry on as soon as
+    /// the ring can see it, so the signal is sent while the mutex is
+    /// still held. Otherwise the executor could be destroyed first
+    void submit(ring_op &op) {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (threads.empty()) { start(); }
+        queued.push_back(&op);
+        if (not uses_io_uring()) {
+            signalled.notify_one();
+        } else if (std::exchange(waiting, false)) {
+            signal();
+        }
+    }
+
+    void run_blocking_thread(std::size_t index) {
+        name_thread(index);
+        while (true) {
+            std::unique_lock<std::mutex> lock{mutex};
+            signalled.wait(
+                    lock, [this]() { return stopping || not queued.empty(); });
+            if (stopping) { return; }
+            auto &op = *queued.front();
+            queued.pop_front();
+            lock.unlock();
+            run_blocking(op);
+            owner.post(op.coro, op.lane);
+        }
+    }
+
+#ifdef F5_MAKHAM_IO_URING
+    void run_ring() {
+        name_thread(0);
+        std::deque<ring_op *> backlog;
+        std::array<std::vector<coroutine_handle<>>, 2> due;
+        unsigned running{};
+        bool armed = false;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                if (stopping) { return; }
+                backlog.insert(backlog.end(), queued.begin(), queued.end());
+                queued.clear();
+                waiting = true;
+            }
+            if (not armed) {
+                if (auto *sqe = ring->next(); sqe) {
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = wake;
+                    sqe->addr = reinterpret_cast<std::uintptr_t>(&wakes);
+                    sqe->len = sizeof(wakes);
+                    sqe->user_data = 0;
+                    armed = true;
+                    ++running;
+                }
+            }
+            while (not backlog.empty() && running < ring->capacity()) {
+                auto *sqe = ring->next();
+                if (not sqe) { break; }
+                auto &op = *backlog.front();
+                backlog.pop_front();
+                sqe->opcode = op.what == ring_op::kind::read ? IORING_OP_READ
+                                                             : IORING_OP_WRITE;
+                sqe->fd = op.fd;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(op.buffer);
+                sqe->len = op.size;
+                sqe->off = op.offset;
+                sqe->user_data = reinterpret_cast<std::uintptr_t>(&op);
+                ++running;
+            }
+            /// Without the eventfd read nothing could wake the thread, so
+            /// it only waits once that is queued
+            if (auto const r = ring->enter(armed);
+                r == -EAGAIN || r == -EBUSY) {
+                /// The kernel is short of resources, so give it a moment
+                /// rather than spinning
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            }
+            ring->reap([&](::io_uring_cqe const &cqe) {
+                --running;
+                if (cqe.user_data) {
+                    auto &op = *reinterpret_cast<ring_op *>(cqe.user_data);
+                    op.result = cqe.res;
+                    due[op.lane == priority::high].push_back(op.coro);
+                } else {
+                    armed = false;
+                }
+            });
+            post(due[1], priority::high);
+            post(due[0], priority::normal);
+        }
+    }
+    void post(std::vector<coroutine_handle<>> &handles, priority p) {
+        if (not handles.empty()) {
+            owner.post_bulk(handles.data(), handles.size(), p);
+            handles.clear();
+        }
+    }
+#else
+    void run_ring() {}
+#endif
+};
+
+
+f5::makham::detail::io_ring::io_ring(
+        executor &e, std::string name, bool uring)
+: pimpl{std::make_unique<impl>(e, std::move(name), uring)} {}
+
+
+f5::makham::detail::io_ring::~io_ring() {
+    {
+        std::lock_guard<std::mutex> lock{pimpl->mutex};
+        pimpl->stopping = true;
+    }
+    pimpl->signal();
+    for (auto &t : pimpl->threads) { t.join(); }
+}
+
+
+void f5::makham::detail::io_ring::submit(ring_op &op) { pimpl->submit(op); }
+
+
+bool f5::makham::detail::io_ring::uses_io_uring() const noexcept {
+    return pimpl->uses_io_uring();
+}
+
+
+std::uint64_t f5::makham::file::size() const {
+    struct ::stat s {};
+    if (::fstat(fd, &s) < 0) { fail("fstat"); }
+    return s.st_size;
+}
+
+
+void f5::makham::file::close() noexcept {
+    if (fd >= 0) { ::close(std::exchange(fd, -1)); }
+}
+
+
+/// Copies of the members are used for the same reason as in the socket
+/// coroutines of `io.cpp`
+auto f5::makham::file::write(
+        void const *buffer, std::size_t size, std::uint64_t offset)
+        -> task<std::size_t> {
+    auto *const e = owner;
+    int const f = fd;
+    auto *bytes = const_cast<char *>(static_cast<char const *>(buffer));
+    std::size_t written{};
+    while (written < size) {
+        auto const n = co_await detail::ring_awaitable{
+                e,
+                detail::ring_op::kind::write,
+                f,
+                bytes + written,
+                size - written,
+                offset + written};
+        if (not n) { break; }
+        written += n;
+    }
+    co_return written;
+}
+
+
+auto f5::makham::open_file(std::string const &path, int flags, mode_t mode)
+        -> file {
+    int const fd = ::open(path.c_str(), flags | O_CLOEXEC, mode);
+    if (fd < 0) { fail("open"); }
+    return file{fd};
+}
@@ -0,0 +1,263 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/frame_pool.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+
+    /// Size classes run from 64 bytes to 4KB, in powers of two
+    constexpr std::size_t smallest_class = 6;
+    constexpr std::size_t class_count = 7;
+    constexpr std::size_t unpooled = class_count;
+    /// Most blocks a thread keeps on each of its free lists
+    constexpr std::size_t free_limit = 1024;
+    /// Blocks gathered for another thread before they are handed back
+    constexpr std::size_t batch_size = 32;
+    /// Number of other threads we gather batches for at once
+    constexpr std::size_t batch_slots = 4;
+
+
+    struct cache;
+
+    /// Precedes every frame and keeps it aligned as `operator new` would
+    struct alignas(alignof(std::max_align_t)) header {
+        cache *owner;
+        std::size_t size_class;
+    };
+    /// A block sitting on a free list
+    struct free_block : header {
+        free_block *next;
+    };
+
+
+    std::size_t class_bytes(std::size_t cls) {
+        return std::size_t{1} << (cls + smallest_class);
+    }
+    std::size_t size_class(std::size_t bytes) {
+        std::size_t cls = 0;
+        while (cls < class_count && class_bytes(cls) < bytes) { ++cls; }
+        return cls;
+    }
+
+
+    /// Counters are only ever written by the owning thread
+    void increment(std::atomic<std::size_t> &c, std::size_t by = 1) {
+        c.store(c.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+    }
+
+
+    /// Hand a chain of blocks back to their owner
+    void push_remote(cache *owner, free_block *head, free_block *tail);
+
+
+    /// ### Thread cache
+    struct cache {
+        free_block *free[class_count] = {};
+        std::size_t length[class_count] = {};
+
+        /// Blocks freed by other threads
+        std::atomic<free_block *> remote = {};
+
+        /// Blocks this thread has freed for other threads
+        struct batch {
+            cache *owner = nullptr;
+            free_block *head = nullptr, *tail = nullptr;
+            std::size_t count = 0;
+        } batches[batch_slots];
+        std::size_t next_eviction = 0;
+
+        std::atomic<std::size_t> hits = {}, misses = {}, bytes = {};
+
+        cache *next_orphan = nullptr;
+
+        void push(free_block *b) {
+            auto const cls = b->size_class;
+            if (length[cls] < free_limit) {
+                b->next = free[cls];
+                free[cls] = b;
+                ++length[cls];
+            } else {
+                ::operator delete(static_cast<header *>(b));
+            }
+        }
+        free_block *pop(std::size_t cls) {
+            if (not free[cls]) { drain(); }
+            if (auto *b = free[cls]; b) {
+                free[cls] = b->next;
+                --length[cls];
+                return b;
+            } else {
+                return nullptr;
+            }
+        }
+        void drain() {
+            auto *b = remote.exchange(nullptr, std::memory_order_acquire);
+            while (b) { push(std::exchange(b, b->next)); }
+        }
+
+        void free_for(cache *owner, free_block *b) {
+            batch *slot = nullptr;
+            for (auto &s : batches) {
+                if (s.owner == owner) {
+                    slot = &s;
+                    break;
+                } else if (not slot && not s.owner) {
+                    slot = &s;
+                }
+            }
+            if (not slot) {
+                slot = &batches[next_eviction++ % batch_slots];
+                flush(*slot);
+            }
+            slot->owner = owner;
+            b->next = slot->head;
+            slot->head = b;
+            if (not slot->tail) { slot->tail = b; }
+            if (++slot->count >= batch_size) { flush(*slot); }
+        }
+        void flush(batch &s) {
+            if (s.owner) { push_remote(s.owner, s.head, s.tail); }
+            s = batch{};
+        }
+        void flush_all() {
+            for (auto &s : batches) { flush(s); }
+        }
+    };
+
+
+    void push_remote(cache *owner, free_block *head, free_block *tail) {
+        auto *old = owner->remote.load(std::memory_order_relaxed);
+        do {
+            tail->next = old;
+        } while (not owner->remote.compare_exchange_weak(
+                old, head, std::memory_order_release,
+                std::memory_order_relaxed));
+    }
+
+
+    /// ### Registry
+    /**
+     * Caches are never freed because blocks they own can be returned to them
+     * at any time. When a thread exits its cache is kept for the next new
+     * thread to adopt.
+     */
+    struct registry {
+        std::mutex mutex;
+        std::vector<cache *> all;
+        cache *orphans = nullptr;
+
+        cache *acquire() {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (orphans) {
+                return std::exchange(orphans, orphans->next_orphan);
+            } else {
+                return all.emplace_back(new cache);
+            }
+        }
+        void release(cache *c) {
+            c->flush_all();
+            std::lock_guard<std::mutex> lock{mutex};
+            c->next_orphan = std::exchange(orphans, c);
+        }
+    };
+    registry &caches() {
+        /// Deliberately never destructed, worker threads may still be exiting
+        static auto *r = new registry;
+        return *r;
+    }
+
+
+    struct thread_cache {
+        cache *c = nullptr;
+        ~thread_cache();
+    };
+    thread_local thread_cache t_cache;
+    thread_local bool t_exited = false;
+    thread_cache::~thread_cache() {
+        t_exited = true;
+        if (c) caches().release(std::exchange(c, nullptr));
+    }
+
+    /// Returns `nullptr` once the thread is exiting, or if it has no cache
+    /// yet and one isn't wanted
+    cache *current(bool create) {
+        if (t_exited) {
+            return nullptr;
+        } else if (not t_cache.c && create) {
+            t_cache.c = caches().acquire();
+        }
+        return t_cache.c;
+    }
+
+
+}
+
+
+auto f5::makham::frame_pool::stats() -> statistics {
+    statistics s;
+    auto &r = caches();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    for (auto const *c : r.all) {
+        s.hits += c->hits.load(std::memory_order_relaxed);
+        s.misses += c->misses.load(std::memory_order_relaxed);
+        s.bytes += c->bytes.load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+
+void *f5::makham::frame_pool::allocate(std::size_t bytes) {
+    auto const total = bytes + sizeof(header);
+    auto const cls = size_class(total);
+    auto *c = current(true);
+    if (c) {
+        increment(c->bytes, bytes);
+        if (cls != unpooled) {
+            if (auto *b = c->pop(cls); b) {
+                increment(c->hits);
+                return new (b) header{c, cls} + 1;
+            }
+        }
+        increment(c->misses);
+    }
+    if (cls == unpooled || not c) {
+        return new (::operator new(total)) header{nullptr, unpooled} + 1;
+    } else {
+        return new (::operator new(class_bytes(cls))) header{c, cls} + 1;
+    }
+}
+
+
+void f5::makham::frame_pool::deallocate(void *frame) noexcept {
+    auto *h = static_cast<header *>(frame) - 1;
+    if (h->size_class == unpooled) {
+        ::operator delete(h);
+        return;
+    }
+    auto *const owner = h->owner;
+    auto const cls = h->size_class;
+    auto *const b = new (h) free_block{{owner, cls}, nullptr};
+    auto *c = current(false);
+    if (c == owner) {
+        c->push(b);
+    } else if (c) {
+        c->free_for(owner, b);
+    } else {
+        push_remote(owner, b, b);
+    }
+}
@@ -0,0 +1,350 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/io.hpp>
+
+#include <array>
+#include <cerrno>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+
+namespace {
+
+
+    [[noreturn]] void fail(char const *what) {
+        throw std::system_error{errno, std::system_category(), what};
+    }
+
+    bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+    void set_non_blocking(int fd) {
+        auto const flags = ::fcntl(fd, F_GETFL);
+        if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            fail("fcntl");
+        }
+    }
+
+
+}
+
+
+#ifdef __linux__
+
+
+/// ### Reactor
+/**
+ * Every file descriptor is registered once, edge triggered for both
+ * directions, with the event data pointing at its handle. An event just
+ * marks the directions ready and collects any waiting coroutines, which are
+ * posted to the executor in bulk once the whole batch has been handled.
+ *
+ * Removing a handle takes its file descriptor out of epoll, but the batch
+ * the thread is handling may still refer to it. Removed handles are only
+ * freed once the thread has finished its current batch, and an eventfd
+ * wakes the thread so that happens promptly.
+ */
+struct f5::makham::detail::reactor::impl {
+    executor &owner;
+    std::string const name;
+    int const epoll;
+    int const wake;
+
+    std::mutex mutex;
+    std::thread thread;
+    std::vector<std::unique_ptr<io_handle>> retired;
+    bool stopping = false;
+
+    impl(executor &e, std::string n)
+    : owner{e},
+      name{std::move(n)},
+      epoll{::epoll_create1(EPOLL_CLOEXEC)},
+      wake{::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)} {
+        if (epoll < 0 || wake < 0) { fail("epoll_create1"); }
+        ::epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (::epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &ev) < 0) {
+            fail("epoll_ctl");
+        }
+    }
+    ~impl() {
+        ::close(wake);
+        ::close(epoll);
+    }
+
+    void signal() {
+        std::uint64_t const one = 1;
+        [[maybe_unused]] auto const w = ::write(wake, &one, sizeof(one));
+    }
+
+    void run() {
+        ::pthread_setname_np(::pthread_self(), name.substr(0, 15).c_str());
+        std::array<::epoll_event, 256> events;
+        std::array<std::vector<coroutine_handle<>>, 2> due;
+        std::vector<std::unique_ptr<io_handle>> freeing;
+        while (true) {
+            auto const n =
+                    ::epoll_wait(epoll, events.data(), events.size(), -1);
+            for (int i{}; i < n; ++i) {
+                auto const what = events[i].events;
+                if (not events[i].data.ptr) {
+                    std::uint64_t count;
+                    [[maybe_unused]] auto const r =
+                            ::read(wake, &count, sizeof(count));
+                    continue;
+                }
+                auto &h = *static_cast<io_handle *>(events[i].data.ptr);
+                if (what & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    if (auto c = h.readable.notify(); c) {
+                        due[h.readable.lane() == priority::high].push_back(c);
+                    }
+                }
+                if (what & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                    if (auto c = h.writable.notify(); c) {
+                        due[h.writable.lane() == priority::high].push_back(c);
+                    }
+                }
+            }
+            post(due[1], priority::high);
+            post(due[0], priority::normal);
+            std::unique_lock<std::mutex> lock{mutex};
+            freeing.swap(retired);
+            if (stopping) { return; }
+            lock.unlock();
+            freeing.clear();
+        }
+    }
+    void post(std::vector<coroutine_handle<>> &handles, priority p) {
+        if (not handles.empty()) {
+            owner.post_bulk(handles.data(), handles.size(), p);
+            handles.clear();
+        }
+    }
+};
+
+
+f5::makham::detail::reactor::reactor(executor &e, std::string name)
+: pimpl{std::make_unique<impl>(e, std::move(name))} {}
+
+
+f5::makham::detail::reactor::~reactor() {
+    {
+        std::lock_guard<std::mutex> lock{pimpl->mutex};
+        pimpl->stopping = true;
+    }
+    if (pimpl->thread.joinable()) {
+        pimpl->signal();
+        pimpl->thread.join();
+    }
+}
+
+
+void f5::makham::detail::reactor::add(io_handle &h) {
+    {
+        std::lock_guard<std::mutex> lock{pimpl->mutex};
+        if (not pimpl->thread.joinable()) {
+            pimpl->thread = std::thread{[w = pimpl.get()]() { w->run(); }};
+        }
+    }
+    ::epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &h;
+    if (::epoll_ctl(pimpl->epoll, EPOLL_CTL_ADD, h.fd, &ev) < 0) {
+        fail("epoll_ctl");
+    }
+}
+
+
+void f5::makham::detail::reactor::remove(std::unique_ptr<io_handle> h) {
+    ::epoll_ctl(pimpl->epoll, EPOLL_CTL_DEL, h->fd, nullptr);
+    std::lock_guard<std::mutex> lock{pimpl->mutex};
+    /// Only the first handle of a batch needs to wake the thread
+    if (pimpl->retired.empty()) { pimpl->signal(); }
+    pimpl->retired.push_back(std::move(h));
+}
+
+
+#else
+
+
+struct f5::makham::detail::reactor::impl {};
+
+f5::makham::detail::reactor::reactor(executor &, std::string) {}
+f5::makham::detail::reactor::~reactor() = default;
+
+void f5::makham::detail::reactor::add(io_handle &) {
+    throw std::logic_error{"Sockets need epoll, which is Linux only"};
+}
+void f5::makham::detail::reactor::remove(std::unique_ptr<io_handle>) {}
+
+
+#endif
+
+
+f5::makham::socket::socket(int fd, executor &e)
+: handle{std::make_unique<detail::io_handle>(fd, e)} {
+    try {
+        set_non_blocking(fd);
+        e.watch(*handle);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+
+void f5::makham::socket::close() {
+    if (handle) {
+        auto const fd = handle->fd;
+        handle->owner.unwatch(std::move(handle));
+        ::close(fd);
+    }
+}
+
+
+std::uint16_t f5::makham::socket::local_port() const {
+    ::sockaddr_storage address{};
+    ::socklen_t length = sizeof(address);
+    if (::getsockname(
+                native_handle(), reinterpret_cast<::sockaddr *>(&address),
+                &length)
+        < 0) {
+        fail("getsockname");
+    }
+    if (address.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<::sockaddr_in6 &>(address).sin6_port);
+    } else {
+        return ntohs(reinterpret_cast<::sockaddr_in &>(address).sin_port);
+    }
+}
+
+
+/// These are lazy tasks, and nothing ties the lifetime of the socket object
+/// they are called on to theirs. It may be moved while they are suspended,
+/// leaving `this` pointing at an empty or destroyed socket. The handle is
+/// on the heap and goes wherever the socket is moved to, so the coroutines
+/// below take a reference to it when they start and don't use `this` again
+auto f5::makham::socket::read(void *buffer, std::size_t size)
+        -> task<std::size_t> {
+    auto &h = *handle;
+    while (true) {
+        auto const got = ::recv(h.fd, buffer, size, 0);
+        if (got >= 0) {
+            co_return got;
+        } else if (would_block()) {
+            co_await h.readable;
+        } else if (errno != EINTR) {
+            fail("recv");
+        }
+    }
+}
+
+
+auto f5::makham::socket::write(void const *buffer, std::size_t size)
+        -> task<std::size_t> {
+    auto &h = *handle;
+    auto const *bytes = static_cast<char const *>(buffer);
+    std::size_t written{};
+    while (written < size) {
+        auto const sent = ::send(
+                h.fd, bytes + written, size - written, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            written += sent;
+        } else if (would_block()) {
+            co_await h.writable;
+        } else if (errno != EINTR) {
+            fail("send");
+        }
+    }
+    co_return written;
+}
+
+
+auto f5::makham::socket::accept() -> task<socket> {
+    auto &h = *handle;
+    while (true) {
+        auto const fd = ::accept4(
+                h.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) {
+            co_return socket{fd, h.owner};
+        } else if (would_block()) {
+            co_await h.readable;
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            fail("accept4");
+        }
+    }
+}
+
+
+auto f5::makham::listen(sockaddr const *address, socklen_t length, int backlog)
+        -> socket {
+    int const fd = ::socket(
+            address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (fd < 0) { fail("socket"); }
+    socket s{fd};
+    int const yes = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) {
+        fail("setsockopt");
+    }
+    if (::bind(fd, address, length) < 0) { fail("bind"); }
+    if (::listen(fd, backlog) < 0) { fail("listen"); }
+    return s;
+}
+
+
+auto f5::makham::connect(sockaddr_storage address, socklen_t length)
+        -> task<socket> {
+    int const fd = ::socket(
+            address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { fail("socket"); }
+    /// A socket that isn't connecting yet is reported as writable, so it
+    /// is only watched once the connection is under way
+    if (::connect(fd, reinterpret_cast<sockaddr const *>(&address), length)
+                < 0
+        && errno != EINPROGRESS) {
+        int const error = errno;
+        ::close(fd);
+        throw std::system_error{error, std::system_category(), "connect"};
+    }
+    socket s{fd};
+    /// Being writable only says something has happened, so wait until
+    /// there is either a peer or an error
+    while (true) {
+        int error{};
+        ::socklen_t size = sizeof(error);
+        if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0) {
+            fail("getsockopt");
+        } else if (error) {
+            throw std::system_error{error, std::system_category(), "connect"};
+        }
+        ::sockaddr_storage peer{};
+        size = sizeof(peer);
+        if (::getpeername(fd, reinterpret_cast<::sockaddr *>(&peer), &size)
+            == 0) {
+            co_return s;
+        } else if (errno != ENOTCONN) {
+            fail("getpeername");
+        }
+        co_await s.handle->writable;
+    }
+}
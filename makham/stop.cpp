@@ -0,0 +1,84 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/stop.hpp>
+
+
+void f5::makham::detail::stop_state::lock() noexcept {
+    while (word.fetch_or(locked_bit, std::memory_order_acquire)
+           & locked_bit) {
+        std::this_thread::yield();
+    }
+}
+void f5::makham::detail::stop_state::unlock() noexcept {
+    word.fetch_and(~locked_bit, std::memory_order_release);
+}
+
+
+bool f5::makham::detail::stop_state::request_stop() noexcept {
+    lock();
+    if (word.load(std::memory_order_relaxed) & requested_bit) {
+        unlock();
+        return false;
+    }
+    word.fetch_or(requested_bit, std::memory_order_release);
+    runner = std::this_thread::get_id();
+    while (first) {
+        auto *const node = std::exchange(first, first->next);
+        if (first) { first->prev = nullptr; }
+        node->prev = node->next = nullptr;
+        node->in = nullptr;
+        running = node;
+        unlock();
+        /// The callback may destroy the node, so it can't be touched again
+        node->run(*node);
+        lock();
+        running = nullptr;
+    }
+    unlock();
+    return true;
+}
+
+
+bool f5::makham::detail::stop_state::add(stop_node &node) noexcept {
+    lock();
+    if (word.load(std::memory_order_relaxed) & requested_bit) {
+        unlock();
+        return false;
+    }
+    node.prev = nullptr;
+    node.next = first;
+    if (first) { first->prev = &node; }
+    first = &node;
+    node.in = this;
+    unlock();
+    return true;
+}
+
+
+void f5::makham::detail::stop_state::remove(stop_node &node) noexcept {
+    lock();
+    if (node.in == this) {
+        if (node.prev) {
+            node.prev->next = node.next;
+        } else {
+            first = node.next;
+        }
+        if (node.next) { node.next->prev = node.prev; }
+        node.prev = node.next = nullptr;
+        node.in = nullptr;
+    } else if (running == &node && runner != std::this_thread::get_id()) {
+        /// Wait for the callback to finish before it can be destroyed
+        while (running == &node) {
+            unlock();
+            std::this_thread::yield();
+            lock();
+        }
+    }
+    unlock();
+}
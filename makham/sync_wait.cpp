@@ -0,0 +1,47 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/sync_wait.hpp>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <thread>
+#endif
+
+
+static_assert(
+        sizeof(std::atomic<unsigned>) == sizeof(unsigned),
+        "The futex needs the atomic to be a plain 32 bit word");
+
+
+void f5::makham::detail::sync_event::sleep(unsigned const expected) {
+#ifdef __linux__
+    ::syscall(
+            SYS_futex, reinterpret_cast<unsigned *>(&state),
+            FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    if (state.load(std::memory_order_relaxed) == expected) {
+        std::this_thread::yield();
+    }
+#endif
+}
+
+
+void f5::makham::detail::sync_event::wake() noexcept {
+#ifdef __linux__
+    /// The waiter may already have seen the set bit and destroyed the
+    /// event, in which case the kernel just finds nobody waiting on the
+    /// address
+    ::syscall(
+            SYS_futex, reinterpret_cast<unsigned *>(&state),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
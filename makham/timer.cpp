@@ -0,0 +1,251 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/timer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+
+namespace {
+
+
+    /// Each level of the wheel has 64 slots, each of which covers 64 times
+    /// as many ticks as a slot of the level below. Seven levels cover more
+    /// than a century of milliseconds.
+    constexpr std::size_t slot_bits = 6, slot_count = 1u << slot_bits;
+    constexpr std::size_t level_count = 7;
+    /// The ticks within one slot of the level
+    constexpr std::uint64_t mask(std::size_t level) {
+        return (std::uint64_t{1} << (slot_bits * level)) - 1;
+    }
+    constexpr std::uint64_t furthest = mask(level_count);
+    constexpr std::chrono::milliseconds tick_length{1};
+    constexpr auto never = std::numeric_limits<std::uint64_t>::max();
+
+
+    using links = f5::makham::detail::timer_links;
+
+    void push_back(links &list, links &node) {
+        node.prev = list.prev;
+        node.next = &list;
+        list.prev->next = &node;
+        list.prev = &node;
+    }
+    void unlink(links &node) {
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = node.next = nullptr;
+    }
+
+
+}
+
+
+/// ### Wheel
+/**
+ * A timer is placed in the lowest level in which its tick and the current
+ * tick fall in the same slot of the level above. As time moves into a new
+ * slot of a level, the timers in it are placed again and so move down a
+ * level, until they reach the bottom level and expire. Starting, expiring
+ * and cancelling a timer are all constant time.
+ *
+ * Everything is guarded by the mutex, but it is only ever held for a few
+ * list operations at a time. Coroutines are posted after it is released,
+ * all of those that expire in a tick in a single bulk post.
+ */
+struct f5::makham::detail::timer_wheel::impl {
+    executor &owner;
+    std::string const name;
+    timer_clock::time_point const origin = timer_clock::now();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::array<std::array<links, slot_count>, level_count> slots;
+    /// Ticks up to this one have been processed
+    std::uint64_t now = {};
+    std::size_t pending = {};
+    /// When the thread next plans to wake up
+    std::uint64_t wake_tick = never;
+    bool stopping = false;
+    std::thread thread;
+
+    /// Expired coroutines waiting to be posted, by priority
+    std::array<std::vector<coroutine_handle<>>, 2> due;
+
+    impl(executor &e, std::string n) : owner{e}, name{std::move(n)} {
+        for (auto &level : slots) {
+            for (auto &list : level) { list.prev = list.next = &list; }
+        }
+    }
+
+    /// The first tick that starts at or after the time
+    std::uint64_t tick_of(timer_clock::time_point tp) const {
+        if (tp <= origin) { return 0; }
+        auto const length = timer_clock::duration{tick_length};
+        return (tp - origin + length - timer_clock::duration{1}) / length;
+    }
+    std::uint64_t current_tick() const {
+        return (timer_clock::now() - origin) / tick_length;
+    }
+
+    void place(timer &t) {
+        /// Only possible after more than a century of uptime
+        if ((t.tick ^ now) > furthest) { t.tick = now | furthest; }
+        std::size_t level{};
+        for (auto diff = (t.tick ^ now) >> slot_bits; diff;
+             diff >>= slot_bits) {
+            ++level;
+        }
+        auto const slot = (t.tick >> (slot_bits * level)) & (slot_count - 1);
+        push_back(slots[level][slot], t);
+    }
+
+    /// Move time on to the tick, gathering up the timers that expire. It
+    /// jumps straight over the ticks where nothing happens
+    void advance(std::uint64_t to) {
+        while (now < to) {
+            auto const next = next_tick();
+            if (next > to) {
+                now = to;
+                return;
+            }
+            now = next;
+            /// The levels that have moved on to their next slot
+            std::size_t top{};
+            while (top + 1 < level_count && not(now & mask(top + 1))) {
+                ++top;
+            }
+            for (auto level = top; level > 0; --level) {
+                auto &list = slots[level][(now >> (slot_bits * level))
+                                          & (slot_count - 1)];
+                while (list.next != &list) {
+                    auto &t = static_cast<timer &>(*list.next);
+                    unlink(t);
+                    place(t);
+                }
+            }
+            auto &list = slots[0][now & (slot_count - 1)];
+            while (list.next != &list) {
+                auto &t = static_cast<timer &>(*list.next);
+                unlink(t);
+                --pending;
+                due[t.lane == priority::high].push_back(t.coro);
+            }
+            if (not due[0].empty() || not due[1].empty()) { return; }
+        }
+    }
+
+    /// The next tick that has timers in it, or where some move down. The
+    /// timers in a level are all in the current slot of the level above,
+    /// and after the current slot of their own level, so the first
+    /// occupied slot found working up from the bottom is the earliest
+    std::uint64_t next_tick() const {
+        if (not pending) { return never; }
+        for (std::size_t level{}; level < level_count; ++level) {
+            auto const shift = slot_bits * level;
+            auto const slot = now >> shift;
+            for (auto s = (slot & (slot_count - 1)) + 1; s < slot_count; ++s) {
+                auto const &list = slots[level][s];
+                if (list.next != &list) {
+                    return ((slot & ~std::uint64_t{slot_count - 1}) | s)
+                            << shift;
+                }
+            }
+        }
+        return never;
+    }
+
+    void run() {
+#ifdef __linux__
+        ::pthread_setname_np(::pthread_self(), name.substr(0, 15).c_str());
+#endif
+        std::unique_lock<std::mutex> lock{mutex};
+        while (not stopping) {
+            advance(current_tick());
+            if (not due[0].empty() || not due[1].empty()) {
+                auto expired = std::exchange(due, {});
+                lock.unlock();
+                post(expired[1], priority::high);
+                post(expired[0], priority::normal);
+                lock.lock();
+                continue;
+            }
+            wake_tick = next_tick();
+            if (wake_tick == never) {
+                wake.wait(lock);
+            } else {
+                wake.wait_until(lock, origin + wake_tick * tick_length);
+            }
+        }
+    }
+    void post(std::vector<coroutine_handle<>> const &handles, priority p) {
+        if (not handles.empty()) {
+            owner.post_bulk(handles.data(), handles.size(), p);
+        }
+    }
+};
+
+
+f5::makham::detail::timer_wheel::timer_wheel(executor &e, std::string name)
+: pimpl{std::make_unique<impl>(e, std::move(name))} {}
+
+
+f5::makham::detail::timer_wheel::~timer_wheel() {
+    {
+        std::lock_guard<std::mutex> lock{pimpl->mutex};
+        pimpl->stopping = true;
+    }
+    pimpl->wake.notify_one();
+    if (pimpl->thread.joinable()) { pimpl->thread.join(); }
+}
+
+
+void f5::makham::detail::timer_wheel::start(timer &t) {
+    auto &w = *pimpl;
+    t.tick = w.tick_of(t.deadline);
+    std::unique_lock<std::mutex> lock{w.mutex};
+    /// Time can jump straight on when there is nothing to move down
+    if (not w.pending) { w.now = std::max(w.now, w.current_tick()); }
+    if (t.tick <= w.now) {
+        lock.unlock();
+        w.owner.post(t.coro, t.lane);
+        return;
+    }
+    if (not w.thread.joinable()) {
+        w.thread = std::thread{[&w]() { w.run(); }};
+    }
+    w.place(t);
+    ++w.pending;
+    if (t.tick < w.wake_tick) {
+        w.wake_tick = t.tick;
+        lock.unlock();
+        w.wake.notify_one();
+    }
+}
+
+
+bool f5::makham::detail::timer_wheel::cancel(timer &t) {
+    std::lock_guard<std::mutex> lock{pimpl->mutex};
+    if (t.next) {
+        unlink(t);
+        --pimpl->pending;
+        return true;
+    } else {
+        return false;
+    }
+}
@@ -0,0 +1,337 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <f5/makham/trace.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+
+namespace {
+
+
+    using f5::makham::trace::event;
+
+
+    std::atomic<bool> g_enabled = true;
+
+
+    /// Nanoseconds since tracing was first used
+    std::uint64_t now() noexcept {
+        using clock = std::chrono::steady_clock;
+        static auto const epoch = clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       clock::now() - epoch)
+                .count();
+    }
+
+
+    /// ### Slot
+    /**
+     * One event in a ring. The low byte of `stamp` is the kind of event
+     * and the rest is its time. `sequence` is one more than the index of
+     * the event in the slot, or zero while the slot is being rewritten.
+     * A reader that sees the same sequence number before and after reading
+     * the other two fields knows it has read a whole event.
+     */
+    struct slot {
+        std::atomic<std::uint64_t> sequence = {}, stamp = {};
+        std::atomic<void const *> frame = {};
+    };
+
+
+    /// ### Ring
+    /**
+     * Only the owning thread writes to a ring. Readers never block it, they
+     * just discard whatever events get overwritten while they read them.
+     */
+    struct ring {
+        std::size_t const index;
+        std::unique_ptr<slot[]> slots{new slot[f5::makham::trace::ring_size]};
+        /// Index of the next event to be written
+        std::atomic<std::uint64_t> head = {};
+        /// Events before this index have been cleared
+        std::atomic<std::uint64_t> floor = {};
+
+        /// Guarded by the registry mutex
+        std::string name;
+        ring *next_orphan = nullptr;
+
+        explicit ring(std::size_t i) : index{i} {}
+
+        void push(event e, void const *frame) noexcept {
+            auto const i = head.load(std::memory_order_relaxed);
+            auto &s = slots[i % f5::makham::trace::ring_size];
+            s.sequence.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            s.stamp.store(now() << 8 | std::uint64_t(e),
+                          std::memory_order_relaxed);
+            s.frame.store(frame, std::memory_order_relaxed);
+            s.sequence.store(i + 1, std::memory_order_release);
+            head.store(i + 1, std::memory_order_release);
+        }
+
+        void read(std::vector<f5::makham::trace::entry> &into) const {
+            auto const end = head.load(std::memory_order_acquire);
+            auto i = floor.load(std::memory_order_relaxed);
+            if (end > f5::makham::trace::ring_size) {
+                i = std::max(i, end - f5::makham::trace::ring_size);
+            }
+            for (; i < end; ++i) {
+                auto const &s = slots[i % f5::makham::trace::ring_size];
+                auto const before = s.sequence.load(std::memory_order_acquire);
+                auto const stamp = s.stamp.load(std::memory_order_relaxed);
+                auto const *frame = s.frame.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                auto const after = s.sequence.load(std::memory_order_relaxed);
+                if (before == i + 1 && after == i + 1) {
+                    into.push_back(
+                            {std::chrono::nanoseconds(stamp >> 8), frame,
+                             event(stamp & 0xff), index});
+                }
+            }
+        }
+    };
+
+
+    /// ### Registry
+    /**
+     * Rings are never freed so that events recorded by threads that have
+     * since exited can still be read. A new thread adopts the ring of one
+     * that has exited, if there is one.
+     */
+    struct registry {
+        std::mutex mutex;
+        std::vector<ring *> all;
+        ring *orphans = nullptr;
+
+        ring *acquire() {
+            std::lock_guard<std::mutex> lock{mutex};
+            ring *r = nullptr;
+            if (orphans) {
+                r = std::exchange(orphans, orphans->next_orphan);
+            } else {
+                r = all.emplace_back(new ring{all.size()});
+            }
+            r->name = "thread " + std::to_string(r->index);
+#ifdef __linux__
+            char name[16] = {};
+            if (::pthread_getname_np(::pthread_self(), name, sizeof(name))
+                == 0) {
+                r->name = name;
+            }
+#endif
+            return r;
+        }
+        void release(ring *r) {
+            std::lock_guard<std::mutex> lock{mutex};
+            r->next_orphan = std::exchange(orphans, r);
+        }
+    };
+    registry &rings() {
+        /// Deliberately never destructed, worker threads may still be exiting
+        static auto *r = new registry;
+        return *r;
+    }
+
+
+    struct thread_ring {
+        ring *r = nullptr;
+        ~thread_ring();
+    };
+    thread_local thread_ring t_ring;
+    thread_local bool t_exited = false;
+    thread_ring::~thread_ring() {
+        t_exited = true;
+        if (r) rings().release(std::exchange(r, nullptr));
+    }
+
+    /// Returns `nullptr` once the thread is exiting
+    ring *current() noexcept {
+        if (t_exited) {
+            return nullptr;
+        } else if (not t_ring.r) {
+            try {
+                t_ring.r = rings().acquire();
+            } catch (...) { return nullptr; }
+        }
+        return t_ring.r;
+    }
+
+
+    /// ### JSON output
+    struct frame_id {
+        void const *frame;
+    };
+    std::ostream &operator<<(std::ostream &os, frame_id f) {
+        static constexpr char digits[] = "0123456789abcdef";
+        auto v = reinterpret_cast<std::uintptr_t>(f.frame);
+        char buffer[2 * sizeof(v) + 2];
+        auto *p = std::end(buffer);
+        do {
+            *--p = digits[v & 0xf];
+            v >>= 4;
+        } while (v);
+        *--p = 'x';
+        *--p = '0';
+        return os.write(p, std::end(buffer) - p);
+    }
+
+    /// Thread names can be anything
+    struct quoted {
+        std::string const &text;
+    };
+    std::ostream &operator<<(std::ostream &os, quoted q) {
+        for (auto const c : q.text) {
+            if (c == '"' || c == '\\') {
+                os << '\\' << c;
+            } else if (static_cast<unsigned char>(c) >= 0x20) {
+                os << c;
+            }
+        }
+        return os;
+    }
+
+    /// The trace format's times are in microseconds
+    struct micros {
+        std::chrono::nanoseconds time;
+    };
+    std::ostream &operator<<(std::ostream &os, micros m) {
+        auto const ns = m.time.count();
+        auto const fraction = std::to_string(1000 + ns % 1000);
+        return os << ns / 1000 << '.' << fraction.substr(1);
+    }
+
+    /// Everything an event line starts with
+    std::ostream &
+            line(std::ostream &os,
+                 char const *phase,
+                 f5::makham::trace::entry const &e) {
+        return os << ",\n{\"ph\":\"" << phase
+                  << "\",\"cat\":\"coroutine\",\"pid\":1,\"tid\":" << e.thread
+                  << ",\"ts\":" << micros{e.time};
+    }
+    void instant(
+            std::ostream &os,
+            char const *name,
+            f5::makham::trace::entry const &e) {
+        line(os, "i", e) << ",\"s\":\"t\",\"name\":\"" << name
+                         << "\",\"args\":{\"frame\":\"" << frame_id{e.frame}
+                         << "\"}}";
+    }
+
+
+}
+
+
+void f5::makham::trace::enable(bool on) noexcept {
+    g_enabled.store(on, std::memory_order_relaxed);
+}
+bool f5::makham::trace::enabled() noexcept {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+
+void f5::makham::trace::emit(event e, void const *frame) noexcept {
+    if (not g_enabled.load(std::memory_order_relaxed)) { return; }
+    if (auto *r = current(); r) { r->push(e, frame); }
+}
+
+
+auto f5::makham::trace::events() -> std::vector<entry> {
+    std::vector<entry> found;
+    auto &r = rings();
+    {
+        std::lock_guard<std::mutex> lock{r.mutex};
+        for (auto const *ring : r.all) { ring->read(found); }
+    }
+    std::stable_sort(
+            found.begin(), found.end(),
+            [](auto const &l, auto const &r) { return l.time < r.time; });
+    return found;
+}
+
+
+void f5::makham::trace::clear() {
+    auto &r = rings();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    for (auto *ring : r.all) {
+        ring->floor.store(
+                ring->head.load(std::memory_order_acquire),
+                std::memory_order_relaxed);
+    }
+}
+
+
+void f5::makham::trace::write_json(std::ostream &os) {
+    /// Rings are only ever added, so every event's thread has a name
+    auto const all = events();
+    std::vector<std::pair<std::size_t, std::string>> names;
+    {
+        auto &r = rings();
+        std::lock_guard<std::mutex> lock{r.mutex};
+        for (auto const *ring : r.all) {
+            names.emplace_back(ring->index, ring->name);
+        }
+    }
+
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+          "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,"
+          "\"args\":{\"name\":\"makham\"}}";
+    for (auto const &[tid, name] : names) {
+        os << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+           << tid << ",\"args\":{\"name\":\"" << quoted{name} << "\"}}";
+    }
+
+    /// Posts that haven't been resumed yet, for the flow arrows
+    std::unordered_set<void const *> posted;
+    /// Slices open on each thread. The start of a slice may have been
+    /// overwritten, in which case its end is dropped too
+    std::vector<std::size_t> depth(names.size());
+    for (auto const &e : all) {
+        switch (e.what) {
+        case event::created: instant(os, "created", e); break;
+        case event::posted:
+            instant(os, "posted", e);
+            line(os, "s", e) << ",\"name\":\"post\",\"id\":\""
+                             << frame_id{e.frame} << "\"}";
+            posted.insert(e.frame);
+            break;
+        case event::resumed:
+            ++depth[e.thread];
+            line(os, "B", e) << ",\"name\":\"" << frame_id{e.frame}
+                             << "\"}";
+            if (posted.erase(e.frame)) {
+                line(os, "f", e) << ",\"bp\":\"e\",\"name\":\"post\","
+                                    "\"id\":\""
+                                 << frame_id{e.frame} << "\"}";
+            }
+            break;
+        case event::suspended:
+            if (depth[e.thread]) {
+                --depth[e.thread];
+                line(os, "E", e) << "}";
+            }
+            break;
+        case event::completed: instant(os, "completed", e); break;
+        case event::destroyed: instant(os, "destroyed", e); break;
+        }
+    }
+    os << "\n]}\n";
+}
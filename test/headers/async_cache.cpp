@@ -0,0 +1 @@
+#include <f5/makham/async_cache.hpp>
@@ -0,0 +1 @@
+#include <f5/makham/task.hpp>
@@ -0,0 +1,131 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async_cache.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/when.hpp>
+
+#include <string>
+
+
+using namespace std::chrono_literals;
+
+
+namespace {
+    std::atomic<std::size_t> loads;
+    f5::makham::async<std::string> fetch(int key) {
+        ++loads;
+        co_return std::to_string(key);
+    }
+    auto const loader = [](int key) { return fetch(key); };
+
+    f5::makham::async<std::string> slow_fetch(int key) {
+        co_await f5::makham::sleep_for(1ms);
+        co_return std::to_string(key);
+    }
+    auto const slow_loader = [](int key) { return slow_fetch(key); };
+
+    f5::makham::async<std::string> thrower(int) {
+        ++loads;
+        throw std::runtime_error{"Ooops, something went wrong"};
+        co_return {};
+    }
+
+    f5::makham::async<std::size_t>
+            reader(f5::makham::async_cache<int, std::string> &cache, int key) {
+        auto const &s = co_await cache.get(key, loader);
+        co_return s.size();
+    }
+    f5::makham::async<std::string> slow_reader(
+            f5::makham::async_cache<int, std::string> &cache, int key) {
+        co_return co_await cache.get(key, slow_loader);
+    }
+}
+
+
+FSL_TEST_SUITE(async_cache);
+
+
+FSL_TEST_FUNCTION(single_flight) {
+    loads.store(0);
+    f5::makham::async_cache<int, std::string> cache;
+    std::vector<f5::makham::async<std::size_t>> readers;
+    for (std::size_t i{}; i < 100; ++i) {
+        readers.push_back(reader(cache, 1234));
+    }
+    for (auto s : f5::makham::sync_wait(
+                 f5::makham::when_all(std::move(readers)))) {
+        FSL_CHECK_EQ(s, 4u);
+    }
+    FSL_CHECK_EQ(loads.load(), 1u);
+    auto const stats = cache.stats();
+    FSL_CHECK_EQ(stats.misses, 1u);
+    FSL_CHECK_EQ(stats.hits + stats.coalesced, 99u);
+}
+
+
+FSL_TEST_FUNCTION(lru) {
+    loads.store(0);
+    f5::makham::async_cache<int, std::string> cache{2, {}, 1};
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(2, loader)), "2");
+    /// Touch 1 so that 2 is the least recently used
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(3, loader)), "3");
+    FSL_CHECK_EQ(loads.load(), 3u);
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(loads.load(), 3u);
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(2, loader)), "2");
+    FSL_CHECK_EQ(loads.load(), 4u);
+    FSL_CHECK_EQ(cache.stats().evictions, 2u);
+}
+
+
+FSL_TEST_FUNCTION(ttl) {
+    loads.store(0);
+    f5::makham::async_cache<int, std::string> cache{16, 20ms};
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(loads.load(), 1u);
+    std::this_thread::sleep_for(30ms);
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(loads.load(), 2u);
+}
+
+
+FSL_TEST_FUNCTION(failed_loads_are_retried) {
+    loads.store(0);
+    f5::makham::async_cache<int, std::string> cache;
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(cache.get(1, thrower)),
+            std::runtime_error &);
+    FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(1, loader)), "1");
+    FSL_CHECK_EQ(loads.load(), 2u);
+}
+
+
+FSL_TEST_FUNCTION(evicted_while_resuming) {
+    /// Once the entry has been evicted the readers hold the only copies
+    /// of its multi, and the last of them to finish destroys it
+    f5::makham::async_cache<int, std::string> cache{1, {}, 1};
+    for (int round{}; round < 100; ++round) {
+        std::vector<f5::makham::async<std::string>> readers;
+        for (std::size_t i{}; i < 8; ++i) {
+            readers.push_back(slow_reader(cache, round));
+        }
+        std::this_thread::sleep_for(round % 3 * 500us);
+        FSL_CHECK_EQ(f5::makham::sync_wait(cache.get(-1, loader)), "-1");
+        for (auto const &s : f5::makham::sync_wait(
+                     f5::makham::when_all(std::move(readers)))) {
+            FSL_CHECK_EQ(s, std::to_string(round));
+        }
+    }
+    FSL_CHECK(cache.stats().evictions >= 100u);
+}
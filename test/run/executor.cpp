@@ -0,0 +1,210 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/executor.hpp>
+#include <f5/makham/future.hpp>
+#include <f5/makham/task.hpp>
+#include <f5/makham/when.hpp>
+
+#include <atomic>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+FSL_TEST_SUITE(executor);
+
+
+FSL_TEST_FUNCTION(overflow) {
+    /// Far more jobs than fit in the queues, and none of them can finish
+    /// until they have all been posted
+    constexpr std::size_t jobs = 100'000;
+    auto const before = f5::makham::overflow_count();
+    std::atomic<bool> go{false};
+    std::atomic<std::size_t> done{};
+    for (std::size_t i{}; i < jobs; ++i) {
+        f5::makham::post([&]() {
+            while (not go) { std::this_thread::yield(); }
+            ++done;
+        });
+    }
+    go = true;
+    while (done < jobs) { std::this_thread::yield(); }
+    FSL_CHECK_EQ(done.load(), jobs);
+    FSL_CHECK(f5::makham::overflow_count() > before);
+}
+
+
+FSL_TEST_FUNCTION(post_bulk) {
+    /// Far more than fit in the queues
+    f5::makham::executor small{{2, 64, "small"}};
+    auto lazy = [](int v) -> f5::makham::task<int> { co_return v; };
+    auto f = [&]() -> f5::makham::future<int> {
+        co_await f5::makham::resume_on(small);
+        std::vector<f5::makham::task<int>> tasks;
+        for (int i{}; i < 1000; ++i) { tasks.push_back(lazy(i)); }
+        auto const values = co_await f5::makham::when_all(std::move(tasks));
+        int total{};
+        for (auto const v : values) { total += v; }
+        co_return total;
+    };
+    FSL_CHECK_EQ(f().get(), 499'500);
+    FSL_CHECK(small.overflow_count() > 0u);
+}
+
+
+FSL_TEST_FUNCTION(resume_on) {
+    f5::makham::executor batch{{1, 64, "batch"}};
+    auto f = [&]() -> f5::makham::future<bool> {
+        auto &started = f5::makham::current_executor();
+        co_await f5::makham::resume_on(batch);
+        bool const moved = f5::makham::executor::current() == &batch;
+        co_await f5::makham::resume_on(started);
+        co_return moved && f5::makham::executor::current() == &started;
+    };
+    FSL_CHECK(f().get());
+}
+
+
+FSL_TEST_FUNCTION(eager_coroutines_stay_put) {
+    f5::makham::executor batch{{1, 64, "batch"}};
+    auto inner = []() -> f5::makham::async<f5::makham::executor *> {
+        co_return f5::makham::executor::current();
+    };
+    auto f = [&]() -> f5::makham::future<bool> {
+        co_await f5::makham::resume_on(batch);
+        auto *const e = co_await inner();
+        co_return e == &batch;
+    };
+    FSL_CHECK(f().get());
+}
+
+
+FSL_TEST_FUNCTION(use_executor) {
+    f5::makham::executor batch{{1, 64, "batch"}};
+    auto where = []() -> f5::makham::async<f5::makham::executor *> {
+        co_return f5::makham::executor::current();
+    };
+    {
+        f5::makham::use_executor const use{batch};
+        FSL_CHECK_EQ(&f5::makham::current_executor(), &batch);
+        FSL_CHECK_EQ(f5::makham::sync_wait(where()), &batch);
+    }
+    FSL_CHECK(f5::makham::executor::current() == nullptr);
+}
+
+
+FSL_TEST_FUNCTION(configure_after_use) {
+    f5::makham::default_executor();
+    FSL_CHECK_EXCEPTION(
+            f5::makham::configure_default_executor({}), std::logic_error &);
+}
+
+
+FSL_TEST_FUNCTION(nodes) {
+    /// Two logical nodes that share the first CPU
+    auto const system = f5::makham::numa_nodes();
+    std::size_t const cpu = system.empty() ? 0 : system[0][0];
+    f5::makham::executor pinned{{4, 64, "pinned", {{cpu}, {cpu}}}};
+    auto f = [&]() -> f5::makham::future<bool> {
+        co_await f5::makham::resume_on(pinned);
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+        co_return CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set);
+#else
+        co_return true;
+#endif
+    };
+    FSL_CHECK(f().get());
+}
+
+
+FSL_TEST_FUNCTION(priority) {
+    auto f = []() -> f5::makham::future<bool> {
+        bool const normal =
+                f5::makham::current_priority() == f5::makham::priority::normal;
+        co_await f5::makham::with_priority(f5::makham::priority::high);
+        co_return normal
+                && f5::makham::current_priority()
+                == f5::makham::priority::high;
+    };
+    FSL_CHECK(f().get());
+}
+
+
+FSL_TEST_FUNCTION(high_lane_first) {
+    /// With the only worker blocked, queue normal jobs and then high ones.
+    /// The high ones must all run before the normal lane gets a turn.
+    f5::makham::executor one{{1, 64, "one", {}, 1000}};
+    std::atomic<bool> blocked{false}, go{false};
+    std::atomic<int> order{}, last_high{}, first_normal{};
+    one.post([&]() {
+        blocked = true;
+        while (not go) { std::this_thread::yield(); }
+    });
+    while (not blocked) { std::this_thread::yield(); }
+    for (int i{}; i < 10; ++i) {
+        one.post([&]() {
+            auto const n = ++order;
+            int expected{};
+            first_normal.compare_exchange_strong(expected, n);
+        });
+    }
+    for (int i{}; i < 10; ++i) {
+        one.post([&]() { last_high = ++order; }, f5::makham::priority::high);
+    }
+    go = true;
+    while (order < 20) { std::this_thread::yield(); }
+    FSL_CHECK_EQ(last_high.load(), 10);
+    FSL_CHECK_EQ(first_normal.load(), 11);
+}
+
+
+FSL_TEST_FUNCTION(no_starvation) {
+    /// A run of high priority jobs is broken to let a normal one in
+    f5::makham::executor one{{1, 64, "one", {}, 4}};
+    std::atomic<bool> blocked{false}, go{false};
+    std::atomic<int> order{}, normal_at{};
+    one.post([&]() {
+        blocked = true;
+        while (not go) { std::this_thread::yield(); }
+    });
+    while (not blocked) { std::this_thread::yield(); }
+    one.post([&]() { normal_at = ++order; });
+    for (int i{}; i < 20; ++i) {
+        one.post([&]() { ++order; }, f5::makham::priority::high);
+    }
+    go = true;
+    while (order < 21) { std::this_thread::yield(); }
+    FSL_CHECK_EQ(normal_at.load(), 5);
+}
+
+
+FSL_TEST_FUNCTION(metrics) {
+    f5::makham::executor e{{2, 64, "metrics", {}, 32, 1}};
+    auto f = [&]() -> f5::makham::future<void> {
+        for (int i{}; i < 100; ++i) {
+            co_await f5::makham::resume_on(e);
+        }
+    };
+    f().get();
+    std::size_t executed{}, sampled{};
+    for (auto const &m : e.metrics()) {
+        executed += m.executed;
+        for (auto const c : m.latency) { sampled += c; }
+    }
+    FSL_CHECK(executed >= 100u);
+    FSL_CHECK(sampled >= 100u);
+}
@@ -0,0 +1,117 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/file.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/when.hpp>
+
+#include <cstdlib>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+
+namespace {
+    /// A file in the temporary directory, removed again afterwards
+    struct temporary {
+        std::string path = "/tmp/makham-file-XXXXXX";
+        temporary() { ::close(::mkstemp(path.data())); }
+        ~temporary() { ::unlink(path.c_str()); }
+    };
+
+    std::string pattern(std::size_t size) {
+        std::string s(size, '\0');
+        for (std::size_t i{}; i < size; ++i) { s[i] = 'a' + i % 26; }
+        return s;
+    }
+
+    f5::makham::async<std::string> read_at(
+            f5::makham::file &f, std::uint64_t offset, std::size_t size) {
+        std::string s(size, '\0');
+        s.resize(co_await f.read(s.data(), s.size(), offset));
+        co_return s;
+    }
+
+    /// Reads the file in pieces, all of them at once
+    void check_small_reads(f5::makham::executor &e) {
+        constexpr std::size_t piece = 16, pieces = 4096;
+        temporary t;
+        auto const contents = pattern(piece * pieces);
+        f5::makham::file f{::open(t.path.c_str(), O_RDWR), e};
+        FSL_CHECK_EQ(
+                f5::makham::sync_wait(
+                        f.write(contents.data(), contents.size(), 0)),
+                contents.size());
+        FSL_CHECK_EQ(f.size(), contents.size());
+        std::vector<f5::makham::async<std::string>> reads;
+        for (std::size_t i{}; i < pieces; ++i) {
+            reads.push_back(read_at(f, i * piece, piece));
+        }
+        auto const got =
+                f5::makham::sync_wait(f5::makham::when_all(std::move(reads)));
+        std::string joined;
+        for (auto const &s : got) { joined += s; }
+        FSL_CHECK(joined == contents);
+    }
+}
+
+
+FSL_TEST_SUITE(file);
+
+
+FSL_TEST_FUNCTION(write_and_read) {
+    temporary t;
+    auto f = f5::makham::open_file(t.path, O_RDWR);
+    FSL_CHECK_EQ(f5::makham::sync_wait(f.write("hello world", 11, 0)), 11u);
+    FSL_CHECK_EQ(f5::makham::sync_wait(read_at(f, 6, 100)), "world");
+    FSL_CHECK_EQ(f5::makham::sync_wait(read_at(f, 11, 100)), "");
+}
+
+
+FSL_TEST_FUNCTION(many_small_reads) {
+    check_small_reads(f5::makham::default_executor());
+}
+
+
+FSL_TEST_FUNCTION(blocking_threads) {
+    f5::makham::executor::options o;
+    o.threads = 2;
+    o.name = "blocking";
+    o.io_uring = false;
+    f5::makham::executor e{o};
+    FSL_CHECK(not e.uses_io_uring());
+    check_small_reads(e);
+}
+
+
+FSL_TEST_FUNCTION(errors) {
+    temporary t;
+    auto f = f5::makham::open_file(t.path);
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(f.write("x", 1, 0)), std::system_error &);
+    FSL_CHECK_EXCEPTION(
+            f5::makham::open_file(t.path + "-missing"), std::system_error &);
+}
+
+
+FSL_TEST_FUNCTION(without_a_descriptor) {
+    temporary t;
+    f5::makham::file empty;
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(read_at(empty, 0, 1)), std::system_error &);
+    auto f = f5::makham::open_file(t.path);
+    auto moved = std::move(f);
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(read_at(f, 0, 1)), std::system_error &);
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(f.write("x", 1, 0)), std::system_error &);
+    FSL_CHECK_EQ(f5::makham::sync_wait(read_at(moved, 0, 1)), "");
+}
@@ -0,0 +1,48 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/frame_pool.hpp>
+
+#include <thread>
+
+
+FSL_TEST_SUITE(frame_pool);
+
+
+FSL_TEST_FUNCTION(reuses_frames) {
+    auto const before = f5::makham::frame_pool::stats();
+    auto *f1 = f5::makham::frame_pool::allocate(100);
+    f5::makham::frame_pool::deallocate(f1);
+    auto *f2 = f5::makham::frame_pool::allocate(100);
+    FSL_CHECK_EQ(f1, f2);
+    f5::makham::frame_pool::deallocate(f2);
+    auto const after = f5::makham::frame_pool::stats();
+    FSL_CHECK(after.hits > before.hits);
+    FSL_CHECK_EQ(after.bytes - before.bytes, 200u);
+}
+
+
+FSL_TEST_FUNCTION(large_frames_miss) {
+    auto const before = f5::makham::frame_pool::stats();
+    auto *f = f5::makham::frame_pool::allocate(1u << 20);
+    f5::makham::frame_pool::deallocate(f);
+    auto const after = f5::makham::frame_pool::stats();
+    FSL_CHECK_EQ(after.misses - before.misses, 1u);
+}
+
+
+FSL_TEST_FUNCTION(freed_on_another_thread) {
+    /// Use a size class no coroutine in these tests needs
+    auto *f = f5::makham::frame_pool::allocate(3000);
+    std::thread{[f]() { f5::makham::frame_pool::deallocate(f); }}.join();
+    /// The other thread handed the frame back when it exited
+    auto *g = f5::makham::frame_pool::allocate(3000);
+    FSL_CHECK_EQ(f, g);
+    f5::makham::frame_pool::deallocate(g);
+}
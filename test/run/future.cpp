@@ -9,6 +9,7 @@
 #include <fost/test>
 #include <f5/makham/async.hpp>
 #include <f5/makham/future.hpp>
+#include <f5/makham/sync_wait.hpp>
 
 
 namespace {
@@ -44,16 +45,13 @@ FSL_TEST_FUNCTION(get_easy) {
 
 
 FSL_TEST_FUNCTION(get_with_await) {
-    // FIXME With the lambda below rather than `wrap` there are
-    // segfaults when running. The `async` can be destructed twice
-    //     auto f = []() -> f5::makham::future<int> { co_return co_await
-    //     answer(); };
+    auto f = []() -> f5::makham::future<int> { co_return co_await answer(); };
+    FSL_CHECK_EQ(f().get(), 42);
     FSL_CHECK_EQ(f5::makham::future<int>::wrap(answer()).get(), 42);
 }
 
 
 FSL_TEST_FUNCTION(seq_fibonacci) {
-    // TODO This test segfaults on both clang and gcc so there is certainly a bug
     FSL_CHECK_EQ(f5::makham::future<unsigned>::wrap(fib(10u)).get(), 55u);
 }
 
@@ -63,3 +61,13 @@ FSL_TEST_FUNCTION(with_nothing) {
     f5::makham::future<void>::wrap(nothing()).get();
     FSL_CHECK(did_nothing);
 }
+
+
+FSL_TEST_FUNCTION(already_complete) {
+    auto a = answer();
+    for (int i{}; i < 1000 && not a.await_ready(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    FSL_CHECK(a.await_ready());
+    FSL_CHECK_EQ(f5::makham::sync_wait(a), 42);
+}
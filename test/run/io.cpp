@@ -0,0 +1,187 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/io.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timeout.hpp>
+#include <f5/makham/when.hpp>
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <string>
+#include <system_error>
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+
+namespace {
+    sockaddr_in loopback(std::uint16_t port) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        return address;
+    }
+    f5::makham::socket listener() {
+        auto const address = loopback(0);
+        return f5::makham::listen(
+                reinterpret_cast<sockaddr const *>(&address),
+                sizeof(address));
+    }
+    f5::makham::task<f5::makham::socket> connect(std::uint16_t port) {
+        auto const address = loopback(port);
+        return f5::makham::connect(
+                reinterpret_cast<sockaddr const *>(&address),
+                sizeof(address));
+    }
+
+    f5::makham::async<void> echo(f5::makham::socket s) {
+        char buffer[4096];
+        while (auto const n = co_await s.read(buffer, sizeof(buffer))) {
+            co_await s.write(buffer, n);
+        }
+    }
+    f5::makham::async<void> serve(f5::makham::socket &l, std::size_t count) {
+        std::vector<f5::makham::async<void>> connections;
+        for (std::size_t i{}; i < count; ++i) {
+            connections.push_back(echo(co_await l.accept()));
+        }
+        co_await f5::makham::when_all(std::move(connections));
+    }
+
+    f5::makham::async<void>
+            send(f5::makham::socket &s, std::string const &message) {
+        co_await s.write(message.data(), message.size());
+    }
+    f5::makham::async<std::string>
+            round_trip(std::uint16_t port, std::string message) {
+        auto s = co_await connect(port);
+        /// Write while reading so neither side's buffers can fill up
+        auto sending = send(s, message);
+        std::string reply(message.size(), '\0');
+        std::size_t got{};
+        while (got < reply.size()) {
+            auto const n =
+                    co_await s.read(reply.data() + got, reply.size() - got);
+            if (not n) { break; }
+            got += n;
+        }
+        reply.resize(got);
+        co_await sending;
+        co_return reply;
+    }
+}
+
+
+FSL_TEST_SUITE(io);
+
+
+FSL_TEST_FUNCTION(echo) {
+    auto l = listener();
+    auto server = serve(l, 1);
+    FSL_CHECK_EQ(
+            f5::makham::sync_wait(round_trip(l.local_port(), "hello")),
+            "hello");
+    f5::makham::sync_wait(std::move(server));
+}
+
+
+FSL_TEST_FUNCTION(large_message) {
+    /// Bigger than the socket buffers, so the writes have to wait
+    auto l = listener();
+    auto server = serve(l, 1);
+    std::string message(1 << 20, '\0');
+    for (std::size_t i{}; i < message.size(); ++i) {
+        message[i] = 'a' + i % 26;
+    }
+    FSL_CHECK(
+            f5::makham::sync_wait(round_trip(l.local_port(), message))
+            == message);
+    f5::makham::sync_wait(std::move(server));
+}
+
+
+FSL_TEST_FUNCTION(many_connections) {
+    constexpr std::size_t clients = 200;
+    auto l = listener();
+    auto server = serve(l, clients);
+    std::vector<f5::makham::async<std::string>> trips;
+    for (std::size_t i{}; i < clients; ++i) {
+        trips.push_back(round_trip(l.local_port(), std::to_string(i)));
+    }
+    auto const replies =
+            f5::makham::sync_wait(f5::makham::when_all(std::move(trips)));
+    for (std::size_t i{}; i < clients; ++i) {
+        FSL_CHECK_EQ(replies[i], std::to_string(i));
+    }
+    f5::makham::sync_wait(std::move(server));
+}
+
+
+FSL_TEST_FUNCTION(end_of_stream) {
+    auto l = listener();
+    auto reader = [&]() -> f5::makham::async<std::size_t> {
+        auto s = co_await l.accept();
+        char buffer[16];
+        co_return co_await s.read(buffer, sizeof(buffer));
+    };
+    auto r = reader();
+    f5::makham::sync_wait(connect(l.local_port())).close();
+    FSL_CHECK_EQ(f5::makham::sync_wait(std::move(r)), 0u);
+}
+
+
+FSL_TEST_FUNCTION(connection_refused) {
+    auto const port = listener().local_port();
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(connect(port)), std::system_error &);
+}
+
+
+FSL_TEST_FUNCTION(backlog_full) {
+    /// Once the connections the listener hasn't accepted fill its
+    /// backlog, the kernel drops new ones until it goes away
+    auto const address = loopback(0);
+    auto l = f5::makham::listen(
+            reinterpret_cast<sockaddr const *>(&address), sizeof(address), 1);
+    auto const port = l.local_port();
+    std::atomic<bool> settled{false};
+    auto attempt = [&]() -> f5::makham::async<bool> {
+        try {
+            co_await connect(port);
+        } catch (std::system_error const &) {}
+        settled = true;
+        co_return true;
+    };
+    std::vector<f5::makham::socket> queued;
+    bool waited = false;
+    for (std::size_t i{}; i < 8 && not waited; ++i) {
+        if (auto s = f5::makham::sync_wait(
+                    f5::makham::with_timeout(connect(port), 100ms));
+            s) {
+            queued.push_back(std::move(*s));
+        } else {
+            waited = true;
+        }
+    }
+    FSL_CHECK(waited);
+    FSL_CHECK(not f5::makham::sync_wait(
+            f5::makham::with_timeout(attempt(), 100ms)));
+    FSL_CHECK(not settled.load());
+    /// Closing the listener refuses the next try, which ends the waits
+    l.close();
+    for (std::size_t i{}; i < 500 && not settled.load(); ++i) {
+        std::this_thread::sleep_for(10ms);
+    }
+    FSL_CHECK(settled.load());
+}
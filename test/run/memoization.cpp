@@ -12,8 +12,13 @@
 #include <f5/makham/async.hpp>
 #include <f5/makham/future.hpp>
 #include <f5/makham/multi.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/when.hpp>
 
 #include <chrono>
+#include <stdexcept>
+#include <vector>
 
 
 using namespace std::chrono_literals;
@@ -21,6 +26,42 @@ using namespace std::chrono_literals;
 
 namespace {
     f5::makham::async<int> answer() { co_return 42; }
+
+    std::atomic<std::size_t> copies;
+    struct table {
+        std::vector<int> rows;
+
+        table(std::size_t n) : rows(n) {}
+        table(table const &t) : rows{t.rows} { ++copies; }
+        table(table &&) = default;
+        table &operator=(table &&) = default;
+    };
+    f5::makham::async<table> load() { co_return table{1000}; }
+    f5::makham::async<table> slow_load() {
+        co_await f5::makham::sleep_for(1ms);
+        co_return table{1000};
+    }
+    f5::makham::async<std::size_t>
+            rows(f5::makham::multi<f5::makham::async<table>> m) {
+        auto const &t = co_await m;
+        co_return t.rows.size();
+    }
+
+    f5::makham::async<int> thrower() {
+        throw std::runtime_error{"Ooops, something went wrong"};
+        co_return 0;
+    }
+    f5::makham::async<int> slow_thrower() {
+        co_await f5::makham::sleep_for(1ms);
+        throw std::runtime_error{"Ooops, something went wrong"};
+    }
+    f5::makham::async<bool>
+            throws(f5::makham::multi<f5::makham::async<int>> m) {
+        try {
+            co_await m;
+            co_return false;
+        } catch (std::runtime_error const &) { co_return true; }
+    }
 }
 
 
@@ -52,3 +93,72 @@ FSL_TEST_FUNCTION(awaiting_without_pause) {
     FSL_CHECK_EQ(f5::makham::future<int>::wrap(a).get(), 42);
     FSL_CHECK_EQ(f5::makham::future<int>::wrap(a).get(), 42);
 }
+
+
+FSL_TEST_FUNCTION(awaiting_many) {
+    f5::makham::multi<f5::makham::async<int>> a{answer()};
+    std::vector<f5::makham::future<int>> waiting;
+    for (std::size_t i{}; i < 200; ++i) {
+        waiting.push_back(f5::makham::future<int>::wrap(a));
+    }
+    for (auto &f : waiting) { FSL_CHECK_EQ(f.get(), 42); }
+    FSL_CHECK_EQ(f5::makham::sync_wait(a), 42);
+}
+
+
+FSL_TEST_FUNCTION(awaiting_joined) {
+    f5::makham::multi<f5::makham::async<int>> a{answer()};
+    auto const [x, y] = f5::makham::sync_wait(f5::makham::when_all(a, a));
+    FSL_CHECK_EQ(x + y, 84);
+}
+
+
+FSL_TEST_FUNCTION(shared_result) {
+    copies.store(0);
+    f5::makham::multi<f5::makham::async<table>> m{load()};
+    std::vector<f5::makham::async<std::size_t>> readers;
+    for (std::size_t i{}; i < 50; ++i) { readers.push_back(rows(m)); }
+    auto const counts =
+            f5::makham::sync_wait(f5::makham::when_all(std::move(readers)));
+    for (auto const c : counts) { FSL_CHECK_EQ(c, 1000u); }
+    FSL_CHECK_EQ(copies.load(), 0u);
+}
+
+
+FSL_TEST_FUNCTION(shared_exception) {
+    f5::makham::multi<f5::makham::async<int>> m{thrower()};
+    FSL_CHECK_EXCEPTION(
+            f5::makham::future<int>::wrap(m).get(), std::runtime_error &);
+    FSL_CHECK_EXCEPTION(f5::makham::sync_wait(m), std::runtime_error &);
+}
+
+
+FSL_TEST_FUNCTION(last_copy_held_by_waiters) {
+    /// The waiters hold the only copies, so the last of them to finish
+    /// destroys the frame, perhaps while the result is still being
+    /// published
+    for (std::size_t round{}; round < 100; ++round) {
+        std::vector<f5::makham::async<std::size_t>> readers;
+        {
+            f5::makham::multi<f5::makham::async<table>> m{slow_load()};
+            for (std::size_t i{}; i < 8; ++i) { readers.push_back(rows(m)); }
+        }
+        auto const counts = f5::makham::sync_wait(
+                f5::makham::when_all(std::move(readers)));
+        for (auto const c : counts) { FSL_CHECK_EQ(c, 1000u); }
+    }
+}
+
+
+FSL_TEST_FUNCTION(last_copy_held_by_waiters_of_exception) {
+    for (std::size_t round{}; round < 100; ++round) {
+        std::vector<f5::makham::async<bool>> waiters;
+        {
+            f5::makham::multi<f5::makham::async<int>> m{slow_thrower()};
+            for (std::size_t i{}; i < 8; ++i) { waiters.push_back(throws(m)); }
+        }
+        auto const caught = f5::makham::sync_wait(
+                f5::makham::when_all(std::move(waiters)));
+        for (auto const c : caught) { FSL_CHECK(c); }
+    }
+}
@@ -0,0 +1,162 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/stop.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/when.hpp>
+
+#include <atomic>
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+
+namespace {
+    /// Counts milliseconds until it is stopped
+    f5::makham::async<int> count_until_stopped(std::atomic<bool> &finished) {
+        auto const token = co_await f5::makham::this_stop_token();
+        int ticks{};
+        while (not token.stop_requested()) {
+            co_await f5::makham::sleep_for(1ms);
+            ++ticks;
+        }
+        finished = true;
+        co_return ticks;
+    }
+}
+
+
+FSL_TEST_SUITE(stop);
+
+
+FSL_TEST_FUNCTION(callbacks) {
+    f5::makham::detail::stop_state state;
+    f5::makham::stop_token const token{state};
+    int ran{};
+    {
+        f5::makham::stop_callback before{token, [&]() { ++ran; }};
+        f5::makham::stop_callback removed{token, [&]() { ran += 10; }};
+    }
+    f5::makham::stop_callback before{token, [&]() { ++ran; }};
+    FSL_CHECK(not token.stop_requested());
+    FSL_CHECK(state.request_stop());
+    FSL_CHECK(token.stop_requested());
+    FSL_CHECK_EQ(ran, 1);
+    FSL_CHECK(not state.request_stop());
+    f5::makham::stop_callback after{token, [&]() { ++ran; }};
+    FSL_CHECK_EQ(ran, 2);
+    FSL_CHECK(not f5::makham::stop_token{}.stop_possible());
+}
+
+
+FSL_TEST_FUNCTION(request_stop) {
+    std::atomic<bool> finished{false};
+    auto counter = count_until_stopped(finished);
+    std::this_thread::sleep_for(20ms);
+    FSL_CHECK(counter.request_stop());
+    FSL_CHECK(not counter.request_stop());
+    FSL_CHECK(f5::makham::sync_wait(std::move(counter)) > 0);
+    FSL_CHECK(finished.load());
+}
+
+
+FSL_TEST_FUNCTION(inherited) {
+    std::atomic<bool> finished{false};
+    auto parent = [&]() -> f5::makham::async<int> {
+        co_return co_await count_until_stopped(finished) + 1;
+    };
+    auto a = parent();
+    std::this_thread::sleep_for(20ms);
+    a.request_stop();
+    FSL_CHECK(f5::makham::sync_wait(std::move(a)) > 1);
+    FSL_CHECK(finished.load());
+}
+
+
+FSL_TEST_FUNCTION(started_before_awaited) {
+    /// The stop arrives while the child is running but not yet awaited,
+    /// and reaches it once it is
+    std::atomic<bool> finished{false};
+    auto parent = [&]() -> f5::makham::async<int> {
+        auto child = count_until_stopped(finished);
+        co_await f5::makham::until_stopped();
+        co_return co_await child;
+    };
+    auto a = parent();
+    std::this_thread::sleep_for(20ms);
+    FSL_CHECK(not finished.load());
+    a.request_stop();
+    FSL_CHECK(f5::makham::sync_wait(std::move(a)) > 0);
+    FSL_CHECK(finished.load());
+}
+
+
+FSL_TEST_FUNCTION(until_stopped) {
+    std::atomic<bool> cleaned_up{false};
+    auto waits = [&]() -> f5::makham::async<void> {
+        co_await f5::makham::until_stopped();
+        cleaned_up = true;
+    };
+    auto a = waits();
+    std::this_thread::sleep_for(10ms);
+    FSL_CHECK(not cleaned_up.load());
+    a.request_stop();
+    f5::makham::sync_wait(std::move(a));
+    FSL_CHECK(cleaned_up.load());
+}
+
+
+FSL_TEST_FUNCTION(when_any_stops_losers) {
+    std::atomic<bool> finished{false};
+    auto quick = []() -> f5::makham::async<int> {
+        co_await f5::makham::sleep_for(10ms);
+        co_return 42;
+    };
+    auto f = [&]() -> f5::makham::async<int> {
+        auto const r = co_await f5::makham::when_any(
+                quick(), count_until_stopped(finished));
+        co_return std::get<0>(r);
+    };
+    FSL_CHECK_EQ(f5::makham::sync_wait(f()), 42);
+    for (int i{}; i < 100 && not finished; ++i) {
+        std::this_thread::sleep_for(5ms);
+    }
+    FSL_CHECK(finished.load());
+}
+
+
+FSL_TEST_FUNCTION(when_all_passes_stops_on) {
+    std::atomic<bool> first{false}, second{false};
+    auto parent = [&]() -> f5::makham::async<int> {
+        auto const [a, b] = co_await f5::makham::when_all(
+                count_until_stopped(first), count_until_stopped(second));
+        co_return (a > 0) + (b > 0);
+    };
+    auto a = parent();
+    std::this_thread::sleep_for(20ms);
+    a.request_stop();
+    FSL_CHECK_EQ(f5::makham::sync_wait(std::move(a)), 2);
+    FSL_CHECK(first.load());
+    FSL_CHECK(second.load());
+}
+
+
+FSL_TEST_FUNCTION(dropped) {
+    /// The coroutine is told to stop and then destroys itself
+    std::atomic<bool> finished{false};
+    count_until_stopped(finished);
+    for (int i{}; i < 100 && not finished; ++i) {
+        std::this_thread::sleep_for(5ms);
+    }
+    FSL_CHECK(finished.load());
+    std::this_thread::sleep_for(5ms);
+}
@@ -0,0 +1,79 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/future.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/task.hpp>
+
+
+namespace {
+    f5::makham::async<int> answer() { co_return 42; }
+
+    std::atomic<bool> did_nothing;
+    f5::makham::async<void> nothing() {
+        did_nothing.store(true);
+        co_return;
+    }
+
+    f5::makham::task<unsigned> fib(unsigned n) {
+        if (n < 3u) {
+            co_return 1;
+        } else {
+            co_return co_await fib(n - 1u) + co_await fib(n - 2u);
+        }
+    }
+
+    f5::makham::async<int> thrower() {
+        throw std::runtime_error{"Ooops, something went wrong"};
+        co_return 0;
+    }
+}
+
+
+FSL_TEST_SUITE(sync_wait);
+
+
+FSL_TEST_FUNCTION(async) {
+    FSL_CHECK_EQ(f5::makham::sync_wait(answer()), 42);
+    did_nothing.store(false);
+    f5::makham::sync_wait(nothing());
+    FSL_CHECK(did_nothing);
+}
+
+
+FSL_TEST_FUNCTION(task) {
+    FSL_CHECK_EQ(f5::makham::sync_wait(fib(10u)), 55u);
+}
+
+
+FSL_TEST_FUNCTION(lvalue) {
+    auto a = answer();
+    FSL_CHECK_EQ(f5::makham::sync_wait(a), 42);
+}
+
+
+FSL_TEST_FUNCTION(exception) {
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(thrower()), std::runtime_error &);
+}
+
+
+FSL_TEST_FUNCTION(help) {
+    for (int i{}; i < 1000; ++i) {
+        FSL_CHECK_EQ(
+                f5::makham::sync_wait(
+                        answer(), f5::makham::waiting::help),
+                42);
+    }
+    FSL_CHECK_EQ(
+            f5::makham::future<int>::wrap(answer()).get(
+                    f5::makham::waiting::help),
+            42);
+}
@@ -0,0 +1,58 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/future.hpp>
+#include <f5/makham/task.hpp>
+
+
+namespace {
+    std::atomic<bool> started;
+    f5::makham::task<int> answer() {
+        started.store(true);
+        co_return 42;
+    }
+
+    f5::makham::task<unsigned> fib(unsigned n) {
+        if (n < 3u) {
+            co_return 1;
+        } else {
+            co_return co_await fib(n - 1u) + co_await fib(n - 2u);
+        }
+    }
+
+    f5::makham::task<void> thrower() {
+        throw std::runtime_error{"Ooops, something went wrong"};
+        co_return;
+    }
+}
+
+
+FSL_TEST_SUITE(task);
+
+
+FSL_TEST_FUNCTION(lazy) {
+    started.store(false);
+    auto t = answer();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    FSL_CHECK(not started.load());
+    FSL_CHECK_EQ(f5::makham::future<int>::wrap(std::move(t)).get(), 42);
+    FSL_CHECK(started.load());
+}
+
+
+FSL_TEST_FUNCTION(nested) {
+    FSL_CHECK_EQ(f5::makham::future<unsigned>::wrap(fib(15u)).get(), 610u);
+}
+
+
+FSL_TEST_FUNCTION(exception) {
+    FSL_CHECK_EXCEPTION(
+            f5::makham::future<void>::wrap(thrower()).get(),
+            std::runtime_error &);
+}
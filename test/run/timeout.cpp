@@ -0,0 +1,138 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/multi.hpp>
+#include <f5/makham/stop.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timeout.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+
+namespace {
+    f5::makham::async<int> answer_after(f5::makham::timer_clock::duration d) {
+        co_await f5::makham::sleep_for(d);
+        co_return 42;
+    }
+}
+
+
+FSL_TEST_SUITE(timeout);
+
+
+FSL_TEST_FUNCTION(in_time) {
+    auto f = []() -> f5::makham::async<std::optional<int>> {
+        co_return co_await f5::makham::with_timeout(answer_after(1ms), 1s);
+    };
+    auto const r = f5::makham::sync_wait(f());
+    FSL_CHECK(r.has_value());
+    FSL_CHECK_EQ(*r, 42);
+}
+
+
+FSL_TEST_FUNCTION(too_late) {
+    std::atomic<bool> finished{false};
+    auto slow = [&]() -> f5::makham::async<int> {
+        co_await f5::makham::sleep_for(200ms);
+        finished = true;
+        co_return 42;
+    };
+    auto f = [&]() -> f5::makham::async<bool> {
+        auto const start = f5::makham::timer_clock::now();
+        auto const r = co_await f5::makham::with_timeout(slow(), 20ms);
+        auto const taken = f5::makham::timer_clock::now() - start;
+        co_return not r.has_value() && taken >= 20ms && taken < 200ms;
+    };
+    FSL_CHECK(f5::makham::sync_wait(f()));
+    FSL_CHECK(not finished.load());
+    /// The slow coroutine still finishes and its result is thrown away
+    std::this_thread::sleep_for(300ms);
+    FSL_CHECK(finished.load());
+}
+
+
+FSL_TEST_FUNCTION(deadline_in_the_past) {
+    auto f = []() -> f5::makham::async<bool> {
+        auto const r = co_await f5::makham::with_deadline(
+                answer_after(50ms), f5::makham::timer_clock::now() - 1s);
+        co_return not r.has_value();
+    };
+    FSL_CHECK(f5::makham::sync_wait(f()));
+    std::this_thread::sleep_for(100ms);
+}
+
+
+FSL_TEST_FUNCTION(exception_in_time) {
+    auto fails = []() -> f5::makham::async<int> {
+        throw std::runtime_error{"failed"};
+        co_return 0;
+    };
+    auto f = [&]() -> f5::makham::async<int> {
+        auto const r = co_await f5::makham::with_timeout(fails(), 1s);
+        co_return *r;
+    };
+    FSL_CHECK_EXCEPTION(
+            f5::makham::sync_wait(f()), std::runtime_error &);
+}
+
+
+FSL_TEST_FUNCTION(void_result) {
+    auto nothing = [](auto d) -> f5::makham::async<void> {
+        co_await f5::makham::sleep_for(d);
+    };
+    auto f = [&]() -> f5::makham::async<int> {
+        int const in_time =
+                co_await f5::makham::with_timeout(nothing(1ms), 1s);
+        int const late =
+                co_await f5::makham::with_timeout(nothing(100ms), 1ms);
+        co_return in_time * 10 + late;
+    };
+    FSL_CHECK_EQ(f5::makham::sync_wait(f()), 10);
+    std::this_thread::sleep_for(150ms);
+}
+
+
+FSL_TEST_FUNCTION(multi) {
+    f5::makham::multi<f5::makham::async<int>> shared{answer_after(30ms)};
+    auto f = [&]() -> f5::makham::async<int> {
+        auto const early = co_await f5::makham::with_timeout(shared, 1ms);
+        auto const later = co_await f5::makham::with_timeout(shared, 1s);
+        co_return early.value_or(0) + later.value_or(-1);
+    };
+    FSL_CHECK_EQ(f5::makham::sync_wait(f()), 42);
+}
+
+
+FSL_TEST_FUNCTION(stops_late_work) {
+    std::atomic<bool> stopped{false};
+    auto slow = [&]() -> f5::makham::async<int> {
+        auto const token = co_await f5::makham::this_stop_token();
+        for (int i{}; i < 1000 && not token.stop_requested(); ++i) {
+            co_await f5::makham::sleep_for(1ms);
+        }
+        stopped = token.stop_requested();
+        co_return 42;
+    };
+    auto f = [&]() -> f5::makham::async<bool> {
+        auto const r = co_await f5::makham::with_timeout(slow(), 20ms);
+        co_return r.has_value();
+    };
+    FSL_CHECK(not f5::makham::sync_wait(f()));
+    for (int i{}; i < 100 && not stopped; ++i) {
+        std::this_thread::sleep_for(5ms);
+    }
+    FSL_CHECK(stopped.load());
+    std::this_thread::sleep_for(5ms);
+}
@@ -0,0 +1,108 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/timer.hpp>
+#include <f5/makham/when.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+
+FSL_TEST_SUITE(timer);
+
+
+FSL_TEST_FUNCTION(sleep_for) {
+    auto f = []() -> f5::makham::async<f5::makham::timer_clock::duration> {
+        auto const start = f5::makham::timer_clock::now();
+        co_await f5::makham::sleep_for(20ms);
+        co_return f5::makham::timer_clock::now() - start;
+    };
+    FSL_CHECK(f5::makham::sync_wait(f()) >= 20ms);
+}
+
+
+FSL_TEST_FUNCTION(sleep_until_the_past) {
+    auto f = []() -> f5::makham::async<bool> {
+        auto *const before = f5::makham::executor::current();
+        co_await f5::makham::sleep_until(
+                f5::makham::timer_clock::now() - 1s);
+        co_return f5::makham::executor::current() == before;
+    };
+    FSL_CHECK(f5::makham::sync_wait(f()));
+}
+
+
+FSL_TEST_FUNCTION(many_timers) {
+    /// Spread over enough time that some of them have to move down levels
+    auto sleeper = [](int i) -> f5::makham::async<bool> {
+        auto const until = f5::makham::timer_clock::now()
+                + std::chrono::milliseconds(i % 150);
+        co_await f5::makham::sleep_until(until);
+        co_return f5::makham::timer_clock::now() >= until;
+    };
+    std::vector<f5::makham::async<bool>> sleepers;
+    for (int i{}; i < 10'000; ++i) { sleepers.push_back(sleeper(i)); }
+    auto const woke = f5::makham::sync_wait(
+            f5::makham::when_all(std::move(sleepers)));
+    FSL_CHECK(std::all_of(woke.begin(), woke.end(), [](bool b) { return b; }));
+}
+
+
+FSL_TEST_FUNCTION(far_apart) {
+    /// The wheel sleeps straight through to the tick where the nearer
+    /// timer moves down a level, with the later one still pending
+    f5::makham::executor one{{1, 64, "one"}};
+    f5::makham::timer later{f5::makham::timer_clock::now() + 1h};
+    later.coro = f5::makham::noop_coroutine();
+    one.start(later);
+    auto f = [&]() -> f5::makham::async<f5::makham::timer_clock::duration> {
+        co_await f5::makham::resume_on(one);
+        auto const start = f5::makham::timer_clock::now();
+        co_await f5::makham::sleep_for(300ms);
+        co_return f5::makham::timer_clock::now() - start;
+    };
+    auto const taken = f5::makham::sync_wait(f());
+    FSL_CHECK(taken >= 300ms);
+    FSL_CHECK(taken < 400ms);
+    FSL_CHECK(one.cancel(later));
+}
+
+FSL_TEST_FUNCTION(sleeping_frees_the_thread) {
+    f5::makham::executor one{{1, 64, "one"}};
+    std::atomic<bool> ran{false};
+    auto f = [&]() -> f5::makham::async<bool> {
+        co_await f5::makham::resume_on(one);
+        one.post([&]() { ran = true; });
+        co_await f5::makham::sleep_for(50ms);
+        co_return ran.load();
+    };
+    FSL_CHECK(f5::makham::sync_wait(f()));
+}
+
+
+FSL_TEST_FUNCTION(cancel) {
+    f5::makham::executor one{{1, 64, "one"}};
+    f5::makham::timer later{f5::makham::timer_clock::now() + 1h};
+    later.coro = f5::makham::noop_coroutine();
+    one.start(later);
+    FSL_CHECK(one.cancel(later));
+    FSL_CHECK(not one.cancel(later));
+
+    f5::makham::timer soon{f5::makham::timer_clock::now() + 1ms};
+    soon.coro = f5::makham::noop_coroutine();
+    one.start(soon);
+    std::this_thread::sleep_for(50ms);
+    FSL_CHECK(not one.cancel(soon));
+}
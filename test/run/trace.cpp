@@ -0,0 +1,134 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/sync_wait.hpp>
+#include <f5/makham/trace.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+
+namespace {
+    /// Addresses that no real frame can have
+    void const *fake(std::size_t i) {
+        return reinterpret_cast<void const *>(i * 16 + 1);
+    }
+    bool is_fake(void const *p) {
+        return reinterpret_cast<std::uintptr_t>(p) & 1;
+    }
+    std::vector<f5::makham::trace::entry> fakes() {
+        auto all = f5::makham::trace::events();
+        all.erase(
+                std::remove_if(
+                        all.begin(), all.end(),
+                        [](auto const &e) { return not is_fake(e.frame); }),
+                all.end());
+        return all;
+    }
+}
+
+
+FSL_TEST_SUITE(trace);
+
+
+FSL_TEST_FUNCTION(records_in_order) {
+    using f5::makham::trace::event;
+    f5::makham::trace::clear();
+    f5::makham::trace::emit(event::created, fake(1));
+    f5::makham::trace::emit(event::resumed, fake(1));
+    f5::makham::trace::emit(event::suspended, fake(1));
+    f5::makham::trace::emit(event::destroyed, fake(1));
+    auto const found = fakes();
+    FSL_CHECK_EQ(found.size(), 4u);
+    FSL_CHECK(found[0].what == event::created);
+    FSL_CHECK(found[3].what == event::destroyed);
+    FSL_CHECK(found[0].time <= found[3].time);
+    FSL_CHECK_EQ(found[0].frame, fake(1));
+    FSL_CHECK_EQ(found[0].thread, found[3].thread);
+}
+
+
+FSL_TEST_FUNCTION(oldest_are_overwritten) {
+    using f5::makham::trace::event;
+    f5::makham::trace::clear();
+    constexpr std::size_t extra = 10;
+    std::thread{[]() {
+        for (std::size_t i{}; i < f5::makham::trace::ring_size + extra; ++i) {
+            f5::makham::trace::emit(event::posted, fake(i));
+        }
+    }}.join();
+    auto const found = fakes();
+    FSL_CHECK_EQ(found.size(), f5::makham::trace::ring_size);
+    FSL_CHECK_EQ(found.front().frame, fake(extra));
+    FSL_CHECK_EQ(
+            found.back().frame,
+            fake(f5::makham::trace::ring_size + extra - 1));
+}
+
+
+FSL_TEST_FUNCTION(can_pause) {
+    f5::makham::trace::clear();
+    f5::makham::trace::enable(false);
+    f5::makham::trace::emit(f5::makham::trace::event::created, fake(1));
+    f5::makham::trace::enable(true);
+    FSL_CHECK(fakes().empty());
+}
+
+
+FSL_TEST_FUNCTION(chrome_json) {
+    using f5::makham::trace::event;
+    f5::makham::trace::clear();
+    /// The end of a slice whose start is gone is dropped
+    f5::makham::trace::emit(event::suspended, fake(1));
+    f5::makham::trace::emit(event::posted, fake(2));
+    f5::makham::trace::emit(event::resumed, fake(2));
+    f5::makham::trace::emit(event::completed, fake(2));
+    f5::makham::trace::emit(event::suspended, fake(2));
+    std::stringstream ss;
+    f5::makham::trace::write_json(ss);
+    auto const json = ss.str();
+    auto const count = [&](std::string const &s) {
+        std::size_t n{};
+        for (auto p = json.find(s); p != std::string::npos;
+             p = json.find(s, p + 1)) {
+            ++n;
+        }
+        return n;
+    };
+    FSL_CHECK_EQ(json.front(), '{');
+    FSL_CHECK_EQ(count("\"ph\":\"B\""), count("\"ph\":\"E\""));
+    FSL_CHECK_EQ(count("\"ph\":\"s\""), 1u);
+    FSL_CHECK_EQ(count("\"ph\":\"f\""), 1u);
+    FSL_CHECK(count("\"name\":\"completed\"") >= 1u);
+    FSL_CHECK(count("\"thread_name\"") >= 1u);
+}
+
+
+#ifdef F5_MAKHAM_TRACE
+FSL_TEST_FUNCTION(coroutine_life_cycle) {
+    using f5::makham::trace::event;
+    f5::makham::trace::clear();
+    auto const f = []() -> f5::makham::async<int> { co_return 42; };
+    FSL_CHECK_EQ(f5::makham::sync_wait(f()), 42);
+    auto const found = f5::makham::trace::events();
+    auto const seen = [&](event what) {
+        return std::any_of(found.begin(), found.end(), [&](auto const &e) {
+            return e.what == what;
+        });
+    };
+    FSL_CHECK(seen(event::created));
+    FSL_CHECK(seen(event::posted));
+    FSL_CHECK(seen(event::resumed));
+    FSL_CHECK(seen(event::suspended));
+    FSL_CHECK(seen(event::completed));
+    FSL_CHECK(seen(event::destroyed));
+}
+#endif
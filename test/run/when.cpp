@@ -0,0 +1,142 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fost/test>
+#include <f5/makham/async.hpp>
+#include <f5/makham/future.hpp>
+#include <f5/makham/task.hpp>
+#include <f5/makham/unit.hpp>
+#include <f5/makham/when.hpp>
+
+
+namespace {
+    f5::makham::async<int> value(int v) { co_return v; }
+
+    std::atomic<unsigned> nothings;
+    f5::makham::async<void> nothing() {
+        ++nothings;
+        co_return;
+    }
+
+    f5::makham::task<int> lazy(int v) { co_return v; }
+    f5::makham::task<void> lazy_nothing() {
+        ++nothings;
+        co_return;
+    }
+
+    f5::makham::async<int> thrower() {
+        throw std::runtime_error{"Ooops, something went wrong"};
+        co_return 0;
+    }
+}
+
+
+FSL_TEST_SUITE(when);
+
+
+FSL_TEST_FUNCTION(all_tuple) {
+    auto f = []() -> f5::makham::future<int> {
+        auto [a, n, b] = co_await f5::makham::when_all(
+                value(1), nothing(), lazy(2));
+        co_return a + b;
+    };
+    nothings.store(0);
+    FSL_CHECK_EQ(f().get(), 3);
+    FSL_CHECK_EQ(nothings.load(), 1u);
+}
+
+
+FSL_TEST_FUNCTION(all_vector) {
+    auto f = []() -> f5::makham::future<int> {
+        std::vector<f5::makham::async<int>> asyncs;
+        for (int i{}; i < 100; ++i) { asyncs.push_back(value(i)); }
+        auto const values = co_await f5::makham::when_all(std::move(asyncs));
+        int total{};
+        for (std::size_t i{}; i < values.size(); ++i) {
+            if (values[i] != int(i)) { co_return -1; }
+            total += values[i];
+        }
+        co_return total;
+    };
+    FSL_CHECK_EQ(f().get(), 4950);
+}
+
+
+FSL_TEST_FUNCTION(all_lazy_vector) {
+    auto f = []() -> f5::makham::future<int> {
+        std::vector<f5::makham::task<int>> tasks;
+        for (int i{}; i < 10'000; ++i) { tasks.push_back(lazy(i)); }
+        auto const values = co_await f5::makham::when_all(std::move(tasks));
+        int total{};
+        for (auto const v : values) { total += v; }
+        co_return total;
+    };
+    FSL_CHECK_EQ(f().get(), 49'995'000);
+}
+
+
+FSL_TEST_FUNCTION(all_empty) {
+    auto f = []() -> f5::makham::future<std::size_t> {
+        auto const values = co_await f5::makham::when_all(
+                std::vector<f5::makham::async<int>>{});
+        co_return values.size();
+    };
+    FSL_CHECK_EQ(f().get(), 0u);
+}
+
+
+FSL_TEST_FUNCTION(all_exception) {
+    auto f = []() -> f5::makham::future<int> {
+        auto [a, b] = co_await f5::makham::when_all(value(1), thrower());
+        co_return a + b;
+    };
+    FSL_CHECK_EXCEPTION(f().get(), std::runtime_error &);
+}
+
+
+FSL_TEST_FUNCTION(any_tuple) {
+    auto f = []() -> f5::makham::future<int> {
+        auto v = co_await f5::makham::when_any(value(1), lazy(2));
+        co_return v.index() == 0 ? std::get<0>(v) : std::get<1>(v);
+    };
+    auto const v = f().get();
+    FSL_CHECK(v == 1 || v == 2);
+}
+
+
+FSL_TEST_FUNCTION(any_vector) {
+    auto f = []() -> f5::makham::future<bool> {
+        std::vector<f5::makham::async<int>> asyncs;
+        for (int i{}; i < 10; ++i) { asyncs.push_back(value(i)); }
+        auto const [index, v] =
+                co_await f5::makham::when_any(std::move(asyncs));
+        co_return int(index) == v;
+    };
+    FSL_CHECK(f().get());
+}
+
+
+FSL_TEST_FUNCTION(unit_block) {
+    nothings.store(0);
+    f5::makham::unit<void> u;
+    for (int i{}; i < 10; ++i) { u.add(nothing()); }
+    FSL_CHECK_EQ(u.block(), 10u);
+    FSL_CHECK_EQ(nothings.load(), 10u);
+}
+
+
+FSL_TEST_FUNCTION(unit_tasks) {
+    nothings.store(0);
+    f5::makham::unit<void> u;
+    for (int i{}; i < 10; ++i) {
+        u.add(nothing());
+        u.add(lazy_nothing());
+    }
+    FSL_CHECK_EQ(u.block(), 20u);
+    FSL_CHECK_EQ(nothings.load(), 20u);
+}
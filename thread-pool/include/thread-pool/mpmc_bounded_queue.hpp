@@ -36,13 +36,27 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <type_traits>
 #include <vector>
 #include <stdexcept>
+#include <thread>
 
 namespace tp {
 
+    namespace detail {
+        inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            asm volatile("yield");
+#else
+            std::this_thread::yield();
+#endif
+        }
+    }
+
     /**
      * @brief The MPMCBoundedQueue class implements bounded
      * multi-producers/multi-consumers lock-free queue.
@@ -82,6 +96,18 @@ namespace tp {
         template<typename U>
         bool push(U &&data);
 
+        /**
+         * @brief pushBulk Push a run of data to queue, reserving the cells
+         * for all of it with a single atomic operation.
+         * @param count Amount of data to push.
+         * @param make Called with the index of each data, in order, to
+         * create it. Only called for data that fits.
+         * @return How much of the data was pushed, less than count if the
+         * queue is too full.
+         */
+        template<typename Make>
+        size_t pushBulk(size_t count, Make &&make);
+
         /**
          * @brief pop Pop data from queue.
          * @param data Place to store popped data.
@@ -89,6 +115,11 @@ namespace tp {
          */
         bool pop(T &data);
 
+        /**
+         * @brief size Number of items, which may already be out of date.
+         */
+        size_t size() const;
+
       private:
         struct Cell {
             std::atomic<size_t> sequence;
@@ -186,6 +217,57 @@ namespace tp {
         return true;
     }
 
+    template<typename T>
+    template<typename Make>
+    inline size_t MPMCBoundedQueue<T>::pushBulk(size_t count, Make &&make) {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t n = std::min(count, m_buffer_mask + 1);
+        while (n) {
+            // Once the last cell is free every cell before it has at least
+            // been claimed by a consumer
+            Cell &last = m_buffer[(pos + n - 1) & m_buffer_mask];
+            size_t seq = last.sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + n - 1);
+            if (dif == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(
+                            pos, pos + n, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                n /= 2;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            Cell &cell = m_buffer[(pos + i) & m_buffer_mask];
+            // Wait for a consumer still moving out of the cell. It is already
+            // part way through pop, so pause like a spinning worker, and
+            // only give up the CPU if it has been preempted
+            for (size_t spins = 0;
+                 cell.sequence.load(std::memory_order_acquire) != pos + i;
+                 ++spins) {
+                if (spins < 64) {
+                    detail::cpu_relax();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            cell.data = make(i);
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+
+        return n;
+    }
+
+    template<typename T>
+    inline size_t MPMCBoundedQueue<T>::size() const {
+        size_t dequeued = m_dequeue_pos.load(std::memory_order_relaxed);
+        size_t enqueued = m_enqueue_pos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
     template<typename T>
     inline bool MPMCBoundedQueue<T>::pop(T &data) {
         Cell *cell;
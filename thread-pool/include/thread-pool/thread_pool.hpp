@@ -5,9 +5,10 @@
 #include <thread-pool/thread_pool_options.hpp>
 #include <thread-pool/worker.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
-#include <stdexcept>
+#include <thread>
 #include <vector>
 
 namespace tp {
@@ -36,45 +37,92 @@ namespace tp {
                 const ThreadPoolOptions &options = ThreadPoolOptions());
 
         /**
-         * Move ctor implementation.
+         * Workers keep pointers into the pool so it can't be moved.
          */
-        ThreadPoolImpl(ThreadPoolImpl &&rhs) noexcept;
+        ThreadPoolImpl(const ThreadPoolImpl &) = delete;
+        ThreadPoolImpl &operator=(const ThreadPoolImpl &) = delete;
 
         /**
          * Stop all workers and destroy thread pool.
          */
         ~ThreadPoolImpl();
 
-        /**
-         * Move assignment implementaion.
-         */
-        ThreadPoolImpl &operator=(ThreadPoolImpl &&rhs) noexcept;
-
         /**
          * Try post job to thread pool.
          * @param handler Handler to be called from thread pool worker. It has
          * to be callable as 'handler()'.
-         * @return 'true' on success, false otherwise.
+         * @param priority Lane to post the job to.
+         * @return 'true' on success, false otherwise. Jobs that don't fit in
+         * the worker's queue go to its overflow so this always succeeds.
          * @note All exceptions thrown by handler will be suppressed.
          */
         template<typename Handler>
-        bool tryPost(Handler &&handler);
+        bool tryPost(Handler &&handler, Priority priority = Priority::Normal);
 
         /**
          * Post job to thread pool.
          * @param handler Handler to be called from thread pool worker. It has
          * to be callable as 'handler()'.
-         * @throw std::overflow_error if worker's queue is full.
+         * @param priority Lane to post the job to.
          * @note All exceptions thrown by handler will be suppressed.
          */
         template<typename Handler>
-        void post(Handler &&handler);
+        void post(Handler &&handler, Priority priority = Priority::Normal);
+
+        /**
+         * Post a batch of jobs, split evenly between the workers. Each
+         * worker's share is reserved in its queue with a single atomic
+         * operation. A worker posting a batch keeps the first share.
+         * @param count Number of jobs.
+         * @param make Called once with each index in [0, count) to create
+         * the job.
+         * @param priority Lane to post the jobs to.
+         */
+        template<typename Make>
+        void postBulk(
+                size_t count,
+                Make &&make,
+                Priority priority = Priority::Normal);
+
+        /**
+         * Run one posted job on the calling thread instead of on a worker.
+         * Lets a thread that is waiting for the pool help it along.
+         * @return 'true' if there was a job to run.
+         * @note All exceptions thrown by the job will be suppressed.
+         */
+        bool tryRunPending();
+
+        /**
+         * Number of jobs that found their worker's queue full and had to
+         * go to its overflow instead.
+         */
+        size_t overflowCount() const;
+
+        /**
+         * Take a snapshot of every worker's counters.
+         * @return Metrics indexed by worker ID.
+         */
+        std::vector<WorkerMetrics> metrics() const;
+
+        /**
+         * Add a sampled post to run latency to the histogram of the
+         * calling thread's worker. Ignored if the calling thread isn't one
+         * of this pool's workers.
+         * @param nanos Time from posting a job until it ran.
+         */
+        void recordLatency(uint64_t nanos);
 
       private:
+        /**
+         * The calling thread's own worker if it belongs to this pool,
+         * otherwise the next one in turn.
+         */
+        size_t getWorkerId();
         Worker<Task, Queue> &getWorker();
 
         std::vector<std::unique_ptr<Worker<Task, Queue>>> m_workers;
         std::atomic<size_t> m_next_worker;
+        std::atomic<size_t> m_parked_workers;
     };
 
 
@@ -83,61 +131,157 @@ namespace tp {
     template<typename Task, template<typename> class Queue>
     inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
             const ThreadPoolOptions &options)
-    : m_workers(options.threadCount()), m_next_worker(0) {
-        for (auto &worker_ptr : m_workers) {
-            worker_ptr.reset(new Worker<Task, Queue>(options.queueSize()));
+    : m_workers(options.threadCount()),
+      m_next_worker(0),
+      m_parked_workers(0) {
+        const auto &nodes = options.nodes();
+        const size_t count = m_workers.size();
+        auto node_of = [&](size_t i) { return i * nodes.size() / count; };
+
+        for (size_t i = 0; i < count; ++i) {
+            auto create = [&, i]() {
+                m_workers[i].reset(new Worker<Task, Queue>(
+                        options.queueSize(), options.spinCount(),
+                        options.starvationLimit()));
+            };
+            if (nodes.empty()) {
+                create();
+            } else {
+                // First touch from the node puts the queues' memory there
+                std::thread([&, i]() {
+                    detail::pin_thread(nodes[node_of(i)]);
+                    create();
+                }).join();
+            }
         }
 
-        for (size_t i = 0; i < m_workers.size(); ++i) {
-            Worker<Task, Queue> *steal_donor =
-                    m_workers[(i + 1) % m_workers.size()].get();
-            m_workers[i]->start(i, steal_donor);
+        for (size_t i = 0; i < count; ++i) {
+            std::vector<Worker<Task, Queue> *> victims;
+            size_t near_victims = 0;
+            for (bool near : {true, false}) {
+                for (size_t j = 0; j < count; ++j) {
+                    const bool same_node =
+                            nodes.empty() || node_of(j) == node_of(i);
+                    if (j != i && same_node == near) {
+                        victims.push_back(m_workers[j].get());
+                        if (near) { ++near_victims; }
+                    }
+                }
+            }
+            auto on_start = options.threadStart();
+            if (!nodes.empty()) {
+                on_start = [cpus = nodes[node_of(i)],
+                            start = std::move(on_start)](size_t id) {
+                    detail::pin_thread(cpus);
+                    if (start) { start(id); }
+                };
+            }
+            m_workers[i]->start(
+                    i, std::move(victims), near_victims, &m_parked_workers,
+                    std::move(on_start));
         }
     }
 
     template<typename Task, template<typename> class Queue>
-    inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
-            ThreadPoolImpl<Task, Queue> &&rhs) noexcept {
-        *this = rhs;
+    inline ThreadPoolImpl<Task, Queue>::~ThreadPoolImpl() {
+        for (auto &worker_ptr : m_workers) { worker_ptr->stop(); }
     }
 
     template<typename Task, template<typename> class Queue>
-    inline ThreadPoolImpl<Task, Queue>::~ThreadPoolImpl() {
-        for (auto &worker_ptr : m_workers) { worker_ptr->stop(); }
+    template<typename Handler>
+    inline bool ThreadPoolImpl<Task, Queue>::tryPost(
+            Handler &&handler, Priority priority) {
+        return getWorker().post(std::forward<Handler>(handler), priority);
     }
 
     template<typename Task, template<typename> class Queue>
-    inline ThreadPoolImpl<Task, Queue> &ThreadPoolImpl<Task, Queue>::operator=(
-            ThreadPoolImpl<Task, Queue> &&rhs) noexcept {
-        if (this != &rhs) {
-            m_workers = std::move(rhs.m_workers);
-            m_next_worker = rhs.m_next_worker.load();
+    template<typename Handler>
+    inline void ThreadPoolImpl<Task, Queue>::post(
+            Handler &&handler, Priority priority) {
+        tryPost(std::forward<Handler>(handler), priority);
+    }
+
+    template<typename Task, template<typename> class Queue>
+    template<typename Make>
+    inline void ThreadPoolImpl<Task, Queue>::postBulk(
+            size_t count, Make &&make, Priority priority) {
+        const size_t workers = m_workers.size();
+        const size_t first = getWorkerId();
+        const size_t shares = std::min(count, workers);
+        size_t begin = 0;
+        for (size_t share = 0; share < shares; ++share) {
+            const size_t end = count * (share + 1) / shares;
+            m_workers[(first + share) % workers]->postBulk(
+                    end - begin,
+                    [&](size_t i) { return make(begin + i); },
+                    priority);
+            begin = end;
         }
-        return *this;
     }
 
     template<typename Task, template<typename> class Queue>
-    template<typename Handler>
-    inline bool ThreadPoolImpl<Task, Queue>::tryPost(Handler &&handler) {
-        return getWorker().post(std::forward<Handler>(handler));
+    inline bool ThreadPoolImpl<Task, Queue>::tryRunPending() {
+        Task task;
+        const size_t count = m_workers.size();
+        const size_t first = detail::random() % count;
+        for (size_t i = 0; i < count; ++i) {
+            if (m_workers[(first + i) % count]->steal(task)) {
+                try {
+                    task();
+                } catch (...) {
+                    // suppress all exceptions
+                }
+                return true;
+            }
+        }
+        return false;
     }
 
     template<typename Task, template<typename> class Queue>
-    template<typename Handler>
-    inline void ThreadPoolImpl<Task, Queue>::post(Handler &&handler) {
-        const auto ok = tryPost(std::forward<Handler>(handler));
-        if (!ok) { throw std::runtime_error("thread pool queue is full"); }
+    inline size_t ThreadPoolImpl<Task, Queue>::overflowCount() const {
+        size_t count = 0;
+        for (auto &worker_ptr : m_workers) {
+            count += worker_ptr->overflowCount();
+        }
+        return count;
     }
 
     template<typename Task, template<typename> class Queue>
-    inline Worker<Task, Queue> &ThreadPoolImpl<Task, Queue>::getWorker() {
+    inline std::vector<WorkerMetrics>
+            ThreadPoolImpl<Task, Queue>::metrics() const {
+        std::vector<WorkerMetrics> all;
+        all.reserve(m_workers.size());
+        for (auto &worker_ptr : m_workers) {
+            all.push_back(worker_ptr->metrics());
+        }
+        return all;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline void ThreadPoolImpl<Task, Queue>::recordLatency(uint64_t nanos) {
         auto id = Worker<Task, Queue>::getWorkerIdForCurrentThread();
+        if (id < m_workers.size()
+            && detail::thread_worker() == m_workers[id].get()) {
+            m_workers[id]->recordLatency(nanos);
+        }
+    }
 
-        if (id > m_workers.size()) {
+    template<typename Task, template<typename> class Queue>
+    inline size_t ThreadPoolImpl<Task, Queue>::getWorkerId() {
+        auto id = Worker<Task, Queue>::getWorkerIdForCurrentThread();
+
+        // The thread may be a worker of another pool
+        if (id >= m_workers.size()
+            || detail::thread_worker() != m_workers[id].get()) {
             id = m_next_worker.fetch_add(1, std::memory_order_relaxed)
                     % m_workers.size();
         }
 
-        return *m_workers[id];
+        return id;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline Worker<Task, Queue> &ThreadPoolImpl<Task, Queue>::getWorker() {
+        return *m_workers[getWorkerId()];
     }
 }
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <algorithm>
+#include <fstream>
+#include <functional>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace tp {
 
@@ -28,6 +33,41 @@ namespace tp {
          */
         void setQueueSize(size_t size);
 
+        /**
+         * @brief setSpinCount Set number of idle spins before parking.
+         * @param count Times an idle worker re-checks the queues before its
+         * thread is parked until new work is posted.
+         */
+        void setSpinCount(size_t count);
+
+        /**
+         * @brief setStarvationLimit Set how many high priority tasks a
+         * worker runs in a row before giving a normal one a turn.
+         * @param count Length of the run, at least one.
+         */
+        void setStarvationLimit(size_t count);
+
+        /**
+         * @brief setThreadStart Set function every worker thread calls
+         * before it runs any tasks.
+         * @param start Called with the worker ID. Use it to name the thread
+         * or to set up thread local state.
+         */
+        void setThreadStart(std::function<void(size_t)> start);
+
+        /**
+         * @brief setNodes Group workers into nodes.
+         * @param nodes The CPUs of each node. Workers are split into
+         * contiguous groups, one per node, and each worker is pinned to
+         * its node's CPUs. Idle workers steal from their own node before
+         * crossing to another one. Each worker's queues are allocated by a
+         * thread already pinned to its node so that the memory is local to
+         * it. Leave empty to neither pin nor group. The sets don't have to
+         * match the hardware, so on a single node machine any split of the
+         * CPUs acts as logical nodes.
+         */
+        void setNodes(std::vector<std::vector<size_t>> nodes);
+
         /**
          * @brief threadCount Return thread count.
          */
@@ -38,16 +78,49 @@ namespace tp {
          */
         size_t queueSize() const;
 
+        /**
+         * @brief spinCount Return number of idle spins before parking.
+         */
+        size_t spinCount() const;
+
+        /**
+         * @brief starvationLimit Return high priority run length.
+         */
+        size_t starvationLimit() const;
+
+        /**
+         * @brief threadStart Return function worker threads call on start.
+         */
+        const std::function<void(size_t)> &threadStart() const;
+
+        /**
+         * @brief nodes Return CPUs of each node workers are grouped into.
+         */
+        const std::vector<std::vector<size_t>> &nodes() const;
+
+        /**
+         * @brief systemNodes Return the CPUs of each NUMA node.
+         * @return One entry per node, read from sysfs on Linux. Empty if
+         * the topology isn't known.
+         */
+        static std::vector<std::vector<size_t>> systemNodes();
+
       private:
         size_t m_thread_count;
         size_t m_queue_size;
+        size_t m_spin_count;
+        size_t m_starvation_limit;
+        std::function<void(size_t)> m_thread_start;
+        std::vector<std::vector<size_t>> m_nodes;
     };
 
     /// Implementation
 
     ThreadPoolOptions::ThreadPoolOptions()
     : m_thread_count(std::max<size_t>(1u, std::thread::hardware_concurrency())),
-      m_queue_size(1024u) {}
+      m_queue_size(1024u),
+      m_spin_count(1024u),
+      m_starvation_limit(32u) {}
 
     void ThreadPoolOptions::setThreadCount(size_t count) {
         m_thread_count = std::max<size_t>(1u, count);
@@ -57,8 +130,73 @@ namespace tp {
         m_queue_size = std::max<size_t>(1u, size);
     }
 
+    void ThreadPoolOptions::setSpinCount(size_t count) {
+        m_spin_count = count;
+    }
+
+    void ThreadPoolOptions::setStarvationLimit(size_t count) {
+        m_starvation_limit = std::max<size_t>(1u, count);
+    }
+
+    void ThreadPoolOptions::setThreadStart(std::function<void(size_t)> start) {
+        m_thread_start = std::move(start);
+    }
+
+    void ThreadPoolOptions::setNodes(std::vector<std::vector<size_t>> nodes) {
+        nodes.erase(
+                std::remove_if(
+                        nodes.begin(), nodes.end(),
+                        [](const std::vector<size_t> &cpus) {
+                            return cpus.empty();
+                        }),
+                nodes.end());
+        m_nodes = std::move(nodes);
+    }
+
     size_t ThreadPoolOptions::threadCount() const { return m_thread_count; }
 
     size_t ThreadPoolOptions::queueSize() const { return m_queue_size; }
 
+    size_t ThreadPoolOptions::spinCount() const { return m_spin_count; }
+
+    size_t ThreadPoolOptions::starvationLimit() const {
+        return m_starvation_limit;
+    }
+
+    const std::function<void(size_t)> &ThreadPoolOptions::threadStart() const {
+        return m_thread_start;
+    }
+
+    const std::vector<std::vector<size_t>> &ThreadPoolOptions::nodes() const {
+        return m_nodes;
+    }
+
+    std::vector<std::vector<size_t>> ThreadPoolOptions::systemNodes() {
+        std::vector<std::vector<size_t>> nodes;
+#ifdef __linux__
+        // sysfs lists are ranges, e.g. "0-3,8-11"
+        auto read_list = [](const std::string &path) {
+            std::vector<size_t> items;
+            std::ifstream list(path);
+            size_t first = 0, last = 0;
+            while (list >> first) {
+                last = first;
+                if (list.peek() == '-') { list.ignore() >> last; }
+                for (size_t item = first; item <= last; ++item) {
+                    items.push_back(item);
+                }
+                if (list.peek() == ',') { list.ignore(); }
+            }
+            return items;
+        };
+        const std::string root = "/sys/devices/system/node/";
+        for (size_t node : read_list(root + "online")) {
+            auto cpus = read_list(
+                    root + "node" + std::to_string(node) + "/cpulist");
+            if (!cpus.empty()) { nodes.push_back(std::move(cpus)); }
+        }
+#endif
+        return nodes;
+    }
+
 }
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace tp {
+
+    /**
+     * @brief The WorkStealingDeque class implements a bounded Chase-Lev
+     * work-stealing deque.
+     * The owner thread pushes and pops at the bottom (LIFO) while any number
+     * of thieves steal from the top (FIFO). The synchronisation follows
+     * "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê,
+     * Pop, Cohen and Zappa Nardelli.
+     * Because T needn't be trivially copyable a thief only touches a slot
+     * after it has claimed it, and every slot carries a sequence number so
+     * the owner never overwrites a slot a thief is still moving out of.
+     */
+    template<typename T>
+    class WorkStealingDeque {
+        static_assert(
+                std::is_move_constructible<T>::value,
+                "Should be of movable type");
+
+      public:
+        /**
+         * @brief WorkStealingDeque Constructor.
+         * @param size Power of 2 number - deque length.
+         * @throws std::invalid_argument if size is bad.
+         */
+        explicit WorkStealingDeque(size_t size);
+
+        WorkStealingDeque(const WorkStealingDeque &) = delete;
+        WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+        /**
+         * @brief push Push data to the bottom. Owner thread only.
+         * @param data Data to be pushed.
+         * @return true on success, false if the deque is full.
+         */
+        template<typename U>
+        bool push(U &&data);
+
+        /**
+         * @brief pop Pop the most recently pushed data. Owner thread only.
+         * @param data Place to store popped data.
+         * @return true on success.
+         */
+        bool pop(T &data);
+
+        /**
+         * @brief steal Take the oldest data. Safe from any thread.
+         * @param data Place to store stolen data.
+         * @return true on success.
+         */
+        bool steal(T &data);
+
+        /**
+         * @brief size Number of items, which may already be out of date.
+         * Safe from any thread.
+         */
+        size_t size() const;
+
+      private:
+        struct Cell {
+            /// Index of the next push allowed to write this cell
+            std::atomic<int64_t> sequence;
+            T data;
+        };
+
+        /// Move the data out of a claimed cell and release it for `next`
+        void take(Cell &cell, T &data, int64_t next);
+
+        typedef char Cacheline[64];
+
+        Cacheline pad0;
+        std::vector<Cell> m_buffer;
+        int64_t m_buffer_mask;
+        Cacheline pad1;
+        std::atomic<int64_t> m_top;
+        Cacheline pad2;
+        std::atomic<int64_t> m_bottom;
+        Cacheline pad3;
+    };
+
+
+    /// Implementation
+
+    template<typename T>
+    inline WorkStealingDeque<T>::WorkStealingDeque(size_t size)
+    : m_buffer(size), m_buffer_mask(size - 1), m_top(0), m_bottom(0) {
+        bool size_is_power_of_2 = (size >= 2) && ((size & (size - 1)) == 0);
+        if (!size_is_power_of_2) {
+            throw std::invalid_argument("buffer size should be a power of 2");
+        }
+
+        for (size_t i = 0; i < size; ++i) { m_buffer[i].sequence = i; }
+    }
+
+    template<typename T>
+    template<typename U>
+    inline bool WorkStealingDeque<T>::push(U &&data) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        Cell &cell = m_buffer[b & m_buffer_mask];
+        if (cell.sequence.load(std::memory_order_acquire) != b) {
+            return false;
+        }
+        cell.data = std::forward<U>(data);
+        m_bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename T>
+    inline bool WorkStealingDeque<T>::pop(T &data) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        Cell &cell = m_buffer[b & m_buffer_mask];
+        if (t < b) {
+            /// More than one left, so no thief can reach this one
+            take(cell, data, b);
+            return true;
+        }
+
+        /// Last one, race the thieves for it
+        bool const won = m_top.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst,
+                std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        if (won) { take(cell, data, b + m_buffer_mask + 1); }
+        return won;
+    }
+
+    template<typename T>
+    inline bool WorkStealingDeque<T>::steal(T &data) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b) { return false; }
+
+        if (!m_top.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed)) {
+            return false;
+        }
+
+        take(m_buffer[t & m_buffer_mask], data, t + m_buffer_mask + 1);
+        return true;
+    }
+
+    template<typename T>
+    inline size_t WorkStealingDeque<T>::size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    template<typename T>
+    inline void WorkStealingDeque<T>::take(Cell &cell, T &data, int64_t next) {
+        data = std::move(cell.data);
+        cell.sequence.store(next, std::memory_order_release);
+    }
+
+}
@@ -1,15 +1,69 @@
 #pragma once
 
+#include <thread-pool/mpmc_bounded_queue.hpp>
+#include <thread-pool/work_stealing_deque.hpp>
+
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace tp {
 
     /**
-     * The Worker class owns task queue and executing thread.
-     * In thread it tries to pop task from queue. If queue is empty then it
-     * tries to steal task from the sibling worker. If steal was unsuccessful
-     * then spins with one millisecond delay.
+     * Lane a task is posted to. Workers drain the high lane first.
+     */
+    enum class Priority { Normal, High };
+
+    /**
+     * A snapshot of what a worker has been doing.
+     */
+    struct WorkerMetrics {
+        /// Bucket i of the latency histogram counts times under 2^i ns
+        static constexpr size_t latencyBuckets = 32;
+
+        /// Tasks the worker has started running
+        size_t executed = 0;
+        /// Siblings the worker tried to steal from, and how many it did
+        size_t stealAttempts = 0;
+        size_t steals = 0;
+        /// Times the worker's thread went to sleep
+        size_t parks = 0;
+        /// Total time spent with nothing to run
+        uint64_t idleNanos = 0;
+        /// Tasks waiting in the worker's queues, not counting the overflow
+        size_t queueDepth = 0;
+        /// Tasks ever put on the overflow
+        size_t overflowed = 0;
+        /// Sampled times from posting a task until it ran
+        std::array<size_t, latencyBuckets> latency = {};
+    };
+
+    /**
+     * The Worker class owns task queues and executing thread.
+     * Tasks posted from the executing thread itself go to a work-stealing
+     * deque and are run newest first. Tasks posted from other threads go to
+     * the queue. Once those are full tasks overflow on to an unbounded lock
+     * free list. In thread it tries to pop task from the deque, then the
+     * queue and then the overflow. If all are empty then it tries to steal
+     * the oldest task from the other workers, starting from a random one,
+     * and after that their overflow. If steal was unsuccessful then it spins
+     * for a while re-checking and after that parks until a new task is
+     * posted.
+     * High priority tasks have their own queue which is always checked
+     * first, except that after a run of high priority tasks a normal one
+     * is given a turn so that it can't be starved.
      */
     template<typename Task, template<typename> class Queue>
     class Worker {
@@ -17,25 +71,36 @@ namespace tp {
         /**
          * Worker Constructor.
          * @param queue_size Length of undelaying task queue.
+         * @param spin_count Number of idle spins before the thread parks.
+         * @param starvation_limit High priority tasks run in a row before
+         * a normal one gets a turn.
          */
-        explicit Worker(size_t queue_size);
+        Worker(size_t queue_size, size_t spin_count, size_t starvation_limit);
 
-        /**
-         * Move ctor implementation.
-         */
-        Worker(Worker &&rhs) noexcept;
+        Worker(const Worker &) = delete;
+        Worker &operator=(const Worker &) = delete;
 
         /**
-         * Move assignment implementaion.
+         * Free any tasks still on the overflow.
          */
-        Worker &operator=(Worker &&rhs) noexcept;
+        ~Worker();
 
         /**
          * Create the executing thread and start tasks execution.
          * @param id Worker ID.
-         * @param steal_donor Sibling worker to steal task from it.
+         * @param victims Sibling workers to steal tasks from, those on the
+         * same node first.
+         * @param near_victims How many of the victims share this worker's
+         * node.
+         * @param parked_count Number of parked workers in the pool.
+         * @param on_start Called on the executing thread before any tasks.
          */
-        void start(size_t id, Worker *steal_donor);
+        void start(
+                size_t id,
+                std::vector<Worker *> victims,
+                size_t near_victims,
+                std::atomic<size_t> *parked_count,
+                std::function<void(size_t)> on_start = {});
 
         /**
          * Stop all worker's thread and stealing activity.
@@ -44,12 +109,34 @@ namespace tp {
         void stop();
 
         /**
-         * Post task to queue.
+         * Post task to queue and wake one parked worker, preferring this
+         * one. If the queue is full the task goes to the overflow instead.
+         * A high priority task that doesn't fit in the high lane's queue
+         * is posted as a normal one.
          * @param handler Handler to be executed in executing thread.
+         * @param priority Lane to post the task to.
          * @return true on success.
          */
         template<typename Handler>
-        bool post(Handler &&handler);
+        bool post(Handler &&handler, Priority priority = Priority::Normal);
+
+        /**
+         * Post a run of tasks to the queue, reserving room for as many as
+         * fit at once, and the rest to the overflow. Then wake one parked
+         * worker as for a single post.
+         * @param count Number of tasks.
+         * @param make Called with each index in [0, count) to create the
+         * task.
+         * @param priority Lane to post the tasks to.
+         */
+        template<typename Make>
+        void postBulk(size_t count, Make &&make, Priority priority);
+
+        /**
+         * Wake the executing thread if it is parked.
+         * @return true if this call is the one that woke it up.
+         */
+        bool unpark();
 
         /**
          * Steal one task from this worker queue.
@@ -64,16 +151,127 @@ namespace tp {
          */
         static size_t getWorkerIdForCurrentThread();
 
+        /**
+         * Number of tasks that found the queues full and were put on the
+         * overflow.
+         */
+        size_t overflowCount() const;
+
+        /**
+         * Take a snapshot of the worker's counters. Safe from any thread.
+         */
+        WorkerMetrics metrics() const;
+
+        /**
+         * Add to the latency histogram. Executing thread only.
+         * @param nanos Time from posting a task until it ran.
+         */
+        void recordLatency(uint64_t nanos);
+
       private:
+        /**
+         * Tasks that didn't fit in the queues. Posting pushes on to a lock
+         * free stack. Taking from it swaps out the whole stack and puts it
+         * in FIFO order on the executing thread's private backlog.
+         */
+        struct Overflow {
+            Task task;
+            Overflow *next;
+        };
+
+        /**
+         * Push a chain of tasks, newest first, on to the overflow.
+         */
+        void pushOverflow(Overflow *first, Overflow *last, size_t count);
+
+        /**
+         * Wake this worker if it is parked, and if not a sibling.
+         */
+        void wake();
+
+        /**
+         * Take the whole overflow stack.
+         * @return Oldest first list of tasks.
+         */
+        Overflow *takeOverflow();
+
+        /**
+         * Take the next task from the backlog, refilling the backlog from
+         * the overflow if it is empty. Whatever fits of the rest of the
+         * backlog is moved to the deque where siblings can steal it.
+         * Executing thread only.
+         * @param more Tasks to add to the backlog first, oldest first.
+         */
+        bool tryGetBacklog(Task &task, Overflow *more = nullptr);
+
         /**
          * Executing thread function.
          * @param id Worker ID to be associated with this thread.
-         * @param steal_donor Sibling worker to steal task from it.
+         * @param on_start Called before any tasks are run.
+         */
+        void threadFunc(size_t id, std::function<void(size_t)> on_start);
+
+        /**
+         * Pop a task from own queues or steal it from a sibling.
          */
-        void threadFunc(size_t id, Worker *steal_donor);
+        bool tryGetTask(Task &task);
 
+        /**
+         * Pop a task from own queues, high lane first unless the normal
+         * lane is due a turn.
+         */
+        bool tryGetOwnTask(Task &task);
+
+        /**
+         * Visit victims on this worker's node and then the rest, starting
+         * each group from a random one, until the visitor returns true.
+         * @return true if the visitor did.
+         */
+        template<typename Visitor>
+        bool visitVictims(Visitor visitor);
+
+        /**
+         * Block the executing thread until it is unparked or stopped.
+         * @param task Place for a task found by the final re-check.
+         * @return true if a task was found instead of parking.
+         */
+        bool park(Task &task);
+
+        /**
+         * Wake one parked sibling, if there is one.
+         */
+        void unparkSibling();
+
+        /// Only ever written by the executing thread
+        struct alignas(64) Counters {
+            std::atomic<size_t> executed{0};
+            std::atomic<size_t> stealAttempts{0};
+            std::atomic<size_t> steals{0};
+            std::atomic<size_t> parks{0};
+            std::atomic<uint64_t> idleNanos{0};
+            std::array<std::atomic<size_t>, WorkerMetrics::latencyBuckets>
+                    latency{};
+        };
+
+        Counters m_counters;
+        Queue<Task> m_high;
+        size_t m_high_streak;
+        size_t m_starvation_limit;
         Queue<Task> m_queue;
+        WorkStealingDeque<Task> m_deque;
+        std::atomic<Overflow *> m_overflow;
+        std::atomic<size_t> m_overflow_count;
+        Overflow *m_backlog;
+        Overflow *m_backlog_tail;
         std::atomic<bool> m_running_flag;
+        size_t m_spin_count;
+        std::vector<Worker *> m_victims;
+        size_t m_near_victims;
+        std::atomic<size_t> *m_parked_count;
+        std::atomic<bool> m_parked;
+        bool m_wakeup;
+        std::mutex m_park_mutex;
+        std::condition_variable m_park_cv;
         std::thread m_thread;
     };
 
@@ -85,38 +283,95 @@ namespace tp {
             static thread_local size_t tss_id = -1u;
             return &tss_id;
         }
-    }
 
-    template<typename Task, template<typename> class Queue>
-    inline Worker<Task, Queue>::Worker(size_t queue_size)
-    : m_queue(queue_size), m_running_flag(true) {}
+        inline const void *&thread_worker() {
+            static thread_local const void *tss_worker = nullptr;
+            return tss_worker;
+        }
 
-    template<typename Task, template<typename> class Queue>
-    inline Worker<Task, Queue>::Worker(Worker &&rhs) noexcept {
-        *this = rhs;
+        /// xorshift32, good enough to spread steal attempts
+        inline uint32_t random() {
+            static thread_local uint32_t state = static_cast<uint32_t>(
+                    std::hash<std::thread::id>{}(std::this_thread::get_id())
+                    | 1u);
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        /// Restrict the calling thread to the CPUs
+        inline void pin_thread(const std::vector<size_t> &cpus) {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (size_t cpu : cpus) {
+                if (cpu < CPU_SETSIZE) { CPU_SET(cpu, &set); }
+            }
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+            (void)cpus;
+#endif
+        }
+
+        /// Counters have a single writer so don't need a read-modify-write
+        template<typename T>
+        inline void increment(std::atomic<T> &counter, T by = 1) {
+            counter.store(
+                    counter.load(std::memory_order_relaxed) + by,
+                    std::memory_order_relaxed);
+        }
     }
 
     template<typename Task, template<typename> class Queue>
-    inline Worker<Task, Queue> &
-            Worker<Task, Queue>::operator=(Worker &&rhs) noexcept {
-        if (this != &rhs) {
-            m_queue = std::move(rhs.m_queue);
-            m_running_flag = rhs.m_running_flag.load();
-            m_thread = std::move(rhs.m_thread);
+    inline Worker<Task, Queue>::Worker(
+            size_t queue_size, size_t spin_count, size_t starvation_limit)
+    : m_high(queue_size),
+      m_high_streak(0),
+      m_starvation_limit(starvation_limit),
+      m_queue(queue_size),
+      m_deque(queue_size),
+      m_overflow(nullptr),
+      m_overflow_count(0),
+      m_backlog(nullptr),
+      m_backlog_tail(nullptr),
+      m_running_flag(true),
+      m_spin_count(spin_count),
+      m_near_victims(0),
+      m_parked_count(nullptr),
+      m_parked(false),
+      m_wakeup(false) {}
+
+    template<typename Task, template<typename> class Queue>
+    inline Worker<Task, Queue>::~Worker() {
+        for (auto *list : {takeOverflow(), m_backlog}) {
+            while (list) { delete std::exchange(list, list->next); }
         }
-        return *this;
     }
 
     template<typename Task, template<typename> class Queue>
     inline void Worker<Task, Queue>::stop() {
         m_running_flag.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(m_park_mutex);
+            m_park_cv.notify_one();
+        }
         if (m_thread.joinable()) { m_thread.join(); }
     }
 
     template<typename Task, template<typename> class Queue>
-    inline void Worker<Task, Queue>::start(size_t id, Worker *steal_donor) {
+    inline void Worker<Task, Queue>::start(
+            size_t id,
+            std::vector<Worker *> victims,
+            size_t near_victims,
+            std::atomic<size_t> *parked_count,
+            std::function<void(size_t)> on_start) {
+        m_victims = std::move(victims);
+        m_near_victims = near_victims;
+        m_parked_count = parked_count;
         m_thread = std::thread(
-                &Worker<Task, Queue>::threadFunc, this, id, steal_donor);
+                &Worker<Task, Queue>::threadFunc, this, id,
+                std::move(on_start));
     }
 
     template<typename Task, template<typename> class Queue>
@@ -126,32 +381,283 @@ namespace tp {
 
     template<typename Task, template<typename> class Queue>
     template<typename Handler>
-    inline bool Worker<Task, Queue>::post(Handler &&handler) {
-        return m_queue.push(std::forward<Handler>(handler));
+    inline bool
+            Worker<Task, Queue>::post(Handler &&handler, Priority priority) {
+        const bool high = priority == Priority::High
+                && m_high.push(std::forward<Handler>(handler));
+        if (!high
+            && (detail::thread_worker() != this
+                || !m_deque.push(std::forward<Handler>(handler)))) {
+            if (!m_queue.push(std::forward<Handler>(handler))) {
+                auto *node = new Overflow{
+                        Task(std::forward<Handler>(handler)), nullptr};
+                pushOverflow(node, node, 1);
+            }
+        }
+        wake();
+        return true;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    template<typename Make>
+    inline void Worker<Task, Queue>::postBulk(
+            size_t count, Make &&make, Priority priority) {
+        size_t done = 0;
+        if (priority == Priority::High) {
+            done = m_high.pushBulk(count, make);
+        }
+        if (done < count) {
+            const size_t offset = done;
+            done += m_queue.pushBulk(count - done, [&](size_t i) {
+                return make(offset + i);
+            });
+        }
+        if (done < count) {
+            Overflow *first = nullptr, *last = nullptr;
+            for (size_t i = done; i < count; ++i) {
+                first = new Overflow{Task(make(i)), first};
+                if (!last) { last = first; }
+            }
+            pushOverflow(first, last, count - done);
+        }
+        wake();
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline void Worker<Task, Queue>::pushOverflow(
+            Overflow *first, Overflow *last, size_t count) {
+        last->next = m_overflow.load(std::memory_order_relaxed);
+        while (!m_overflow.compare_exchange_weak(
+                last->next, first, std::memory_order_release,
+                std::memory_order_relaxed))
+            ;
+        m_overflow_count.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline void Worker<Task, Queue>::wake() {
+        /// Pairs with the fence in `park` so that either the parking thread
+        /// sees the new task or we see that it is parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_parked_count->load(std::memory_order_relaxed) && !unpark()) {
+            unparkSibling();
+        }
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline bool Worker<Task, Queue>::unpark() {
+        if (!m_parked.load(std::memory_order_relaxed)) { return false; }
+        std::lock_guard<std::mutex> lock(m_park_mutex);
+        if (!m_parked.load(std::memory_order_relaxed) || m_wakeup) {
+            return false;
+        }
+        m_wakeup = true;
+        m_park_cv.notify_one();
+        return true;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline void Worker<Task, Queue>::unparkSibling() {
+        const size_t count = m_victims.size();
+        if (!count) { return; }
+        const size_t first = detail::random() % count;
+        for (size_t i = 0; i < count; ++i) {
+            if (m_victims[(first + i) % count]->unpark()) { return; }
+        }
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline size_t Worker<Task, Queue>::overflowCount() const {
+        return m_overflow_count.load(std::memory_order_relaxed);
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline WorkerMetrics Worker<Task, Queue>::metrics() const {
+        WorkerMetrics m;
+        m.executed = m_counters.executed.load(std::memory_order_relaxed);
+        m.stealAttempts =
+                m_counters.stealAttempts.load(std::memory_order_relaxed);
+        m.steals = m_counters.steals.load(std::memory_order_relaxed);
+        m.parks = m_counters.parks.load(std::memory_order_relaxed);
+        m.idleNanos = m_counters.idleNanos.load(std::memory_order_relaxed);
+        m.queueDepth = m_high.size() + m_deque.size() + m_queue.size();
+        m.overflowed = overflowCount();
+        for (size_t i = 0; i < m.latency.size(); ++i) {
+            m.latency[i] =
+                    m_counters.latency[i].load(std::memory_order_relaxed);
+        }
+        return m;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline void Worker<Task, Queue>::recordLatency(uint64_t nanos) {
+        size_t bucket = 0;
+        while (bucket + 1 < WorkerMetrics::latencyBuckets
+               && (nanos >> bucket)) {
+            ++bucket;
+        }
+        detail::increment<size_t>(m_counters.latency[bucket]);
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline auto Worker<Task, Queue>::takeOverflow() -> Overflow * {
+        if (!m_overflow.load(std::memory_order_relaxed)) { return nullptr; }
+        Overflow *stack =
+                m_overflow.exchange(nullptr, std::memory_order_acquire);
+        Overflow *list = nullptr;
+        while (stack) {
+            Overflow *node = std::exchange(stack, stack->next);
+            node->next = std::exchange(list, node);
+        }
+        return list;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline bool Worker<Task, Queue>::tryGetBacklog(Task &task, Overflow *more) {
+        if (!more && !m_backlog) { more = takeOverflow(); }
+        while (more) {
+            Overflow *node = std::exchange(more, more->next);
+            node->next = nullptr;
+            if (m_backlog_tail) {
+                m_backlog_tail->next = node;
+            } else {
+                m_backlog = node;
+            }
+            m_backlog_tail = node;
+        }
+        if (!m_backlog) { return false; }
+
+        Overflow *node = std::exchange(m_backlog, m_backlog->next);
+        task = std::move(node->task);
+        delete node;
+        while (m_backlog && m_deque.push(std::move(m_backlog->task))) {
+            delete std::exchange(m_backlog, m_backlog->next);
+        }
+        if (!m_backlog) { m_backlog_tail = nullptr; }
+        return true;
     }
 
     template<typename Task, template<typename> class Queue>
     inline bool Worker<Task, Queue>::steal(Task &task) {
-        return m_queue.pop(task);
+        return m_high.pop(task) || m_deque.steal(task) || m_queue.pop(task);
     }
 
     template<typename Task, template<typename> class Queue>
-    inline void Worker<Task, Queue>::threadFunc(size_t id, Worker *steal_donor) {
+    inline void Worker<Task, Queue>::threadFunc(
+            size_t id, std::function<void(size_t)> on_start) {
         *detail::thread_id() = id;
+        detail::thread_worker() = this;
+        if (on_start) { on_start(id); }
 
         Task handler;
+        size_t spins = 0;
+        // Only read the clock as the worker goes idle and when it wakes
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point idle_since;
+        bool idle = false;
 
         while (m_running_flag.load(std::memory_order_relaxed)) {
-            if (m_queue.pop(handler) || steal_donor->steal(handler)) {
+            if (tryGetTask(handler)
+                || (++spins > m_spin_count && park(handler))) {
+                spins = 0;
+                if (idle) {
+                    idle = false;
+                    detail::increment<uint64_t>(
+                            m_counters.idleNanos,
+                            std::chrono::duration_cast<
+                                    std::chrono::nanoseconds>(
+                                    Clock::now() - idle_since)
+                                    .count());
+                }
+                detail::increment<size_t>(m_counters.executed);
                 try {
                     handler();
                 } catch (...) {
                     // suppress all exceptions
                 }
             } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (!idle) {
+                    idle = true;
+                    idle_since = Clock::now();
+                }
+                if (spins > m_spin_count) {
+                    spins = 0;
+                } else {
+                    detail::cpu_relax();
+                }
             }
         }
     }
 
+    template<typename Task, template<typename> class Queue>
+    inline bool Worker<Task, Queue>::tryGetOwnTask(Task &task) {
+        if (m_high_streak < m_starvation_limit && m_high.pop(task)) {
+            ++m_high_streak;
+            return true;
+        }
+        m_high_streak = 0;
+        return m_deque.pop(task) || m_queue.pop(task) || tryGetBacklog(task)
+                || m_high.pop(task);
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline bool Worker<Task, Queue>::tryGetTask(Task &task) {
+        if (tryGetOwnTask(task)) { return true; }
+        auto stole = [this](bool success) {
+            detail::increment<size_t>(m_counters.stealAttempts);
+            if (success) { detail::increment<size_t>(m_counters.steals); }
+            return success;
+        };
+        if (visitVictims([&](Worker &victim) {
+                return stole(victim.steal(task));
+            })) {
+            return true;
+        }
+        Overflow *stolen = nullptr;
+        if (visitVictims([&](Worker &victim) {
+                return stole((stolen = victim.takeOverflow()) != nullptr);
+            })) {
+            return tryGetBacklog(task, stolen);
+        }
+        return false;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    template<typename Visitor>
+    inline bool Worker<Task, Queue>::visitVictims(Visitor visitor) {
+        const size_t bounds[] = {0, m_near_victims, m_victims.size()};
+        for (size_t group = 0; group < 2; ++group) {
+            const size_t begin = bounds[group];
+            const size_t count = bounds[group + 1] - begin;
+            if (!count) { continue; }
+            const size_t first = detail::random() % count;
+            for (size_t i = 0; i < count; ++i) {
+                if (visitor(*m_victims[begin + (first + i) % count])) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    template<typename Task, template<typename> class Queue>
+    inline bool Worker<Task, Queue>::park(Task &task) {
+        std::unique_lock<std::mutex> lock(m_park_mutex);
+        m_parked.store(true, std::memory_order_relaxed);
+        m_parked_count->fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool const found = tryGetTask(task);
+        if (!found) {
+            detail::increment<size_t>(m_counters.parks);
+            m_park_cv.wait(lock, [this]() {
+                return m_wakeup
+                        || !m_running_flag.load(std::memory_order_relaxed);
+            });
+        }
+        m_wakeup = false;
+        m_parked.store(false, std::memory_order_relaxed);
+        m_parked_count->fetch_sub(1, std::memory_order_relaxed);
+        return found;
+    }
+
 }